@@ -0,0 +1,70 @@
+#ifndef DIR_WATCH_H
+#define DIR_WATCH_H
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#include <filesystem>
+#include <string>
+#include <unordered_set>
+
+// Files added, rewritten, renamed or removed in one directory, read from a
+// non-blocking inotify descriptor that the render thread drains once per
+// frame. Writes count when the file is closed, so a page still being
+// copied in shows up once it is complete.
+class DirWatch {
+public:
+    ~DirWatch() { stop(); }
+
+    bool start(const std::string& dir) {
+        stop();
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+            return false;
+        if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            stop();
+            return false;
+        }
+        directory = dir;
+        return true;
+    }
+
+    void stop() {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    // Adds the paths of the files changed since the last call to `changed`,
+    // spelled like directory_iterator spells them; returns whether any did
+    bool poll(std::unordered_set<std::string>& changed) {
+        if (fd < 0)
+            return false;
+        alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+        bool any = false;
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // Events were dropped, any file may have changed
+                    std::error_code error;
+                    for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+                        changed.insert(entry.path().string());
+                    any = true;
+                } else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                    changed.insert((std::filesystem::path(directory) / event->name).string());
+                    any = true;
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        return any;
+    }
+
+private:
+    int fd = -1;
+    std::string directory;
+};
+
+#endif // DIR_WATCH_H
@@ -0,0 +1,229 @@
+#ifndef DIRECT_DECODE_H
+#define DIRECT_DECODE_H
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdio>
+#include <jpeglib.h>
+#include <png.h>
+#include <atomic>
+#include <csetjmp>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Zero-copy page decoding. The render thread owns a ring of slots inside
+// one persistently mapped GL_PIXEL_UNPACK_BUFFER; the loader decodes a
+// page scanline by scanline straight into a slot, already in BGRA and
+// bottom-up row order, and the render thread fills the texture from the
+// buffer. No full-page heap bitmap exists on the way.
+
+// Fills the bound texture from BGRA levels packed one after another, the
+// way buildMipChain lays them out behind level 0. With an unpack buffer
+// bound `data` is an offset into it.
+inline void texImageLevels(const unsigned char* data, int width, int height, int levels) {
+    for (int level = 0; level < levels; ++level) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, data);
+        data += size_t(width) * height * 4;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+class UploadRing {
+public:
+    // Render thread. Returns false when the driver lacks ARB_buffer_storage.
+    bool create(int slots, size_t bytes_per_slot) {
+        if (!GLEW_ARB_buffer_storage)
+            return false;
+        slot_bytes = bytes_per_slot;
+        count = slots;
+        // Readable as well: the loader builds the mip chain from the decoded
+        // page, and a write-only mapping may be uncached memory
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slot_bytes * count, nullptr, flags);
+        mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_bytes * count, flags));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!mapped) {
+            glDeleteBuffers(1, &buffer);
+            return false;
+        }
+        busy.reset(new std::atomic<bool>[count]);
+        for (int i = 0; i < count; ++i)
+            busy[i] = false;
+        fences.assign(count, nullptr);
+        return true;
+    }
+
+    bool available() const { return mapped != nullptr; }
+
+    // Loader thread: claims a free slot big enough for `bytes`, or -1
+    int acquire(size_t bytes) {
+        if (!mapped || bytes > slot_bytes)
+            return -1;
+        for (int i = 0; i < count; ++i) {
+            bool expected = false;
+            if (busy[i].compare_exchange_strong(expected, true))
+                return i;
+        }
+        return -1;
+    }
+
+    unsigned char* data(int slot) { return mapped + slot * slot_bytes; }
+
+    // Any thread, for a slot the GPU has not been told to read
+    void release(int slot) { busy[slot] = false; }
+
+    // Render thread: fills the bound texture from a slot holding `levels`
+    // mip levels. The slot is freed by reclaim() once the GPU has finished
+    // reading it.
+    void upload(int slot, int width, int height, int levels = 1) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        texImageLevels(reinterpret_cast<const unsigned char*>(slot * slot_bytes), width, height, levels);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Render thread, once per frame
+    void reclaim() {
+        for (int i = 0; i < count; ++i) {
+            if (!fences[i])
+                continue;
+            GLenum state = glClientWaitSync(fences[i], 0, 0);
+            if (state == GL_ALREADY_SIGNALED || state == GL_CONDITION_SATISFIED) {
+                glDeleteSync(fences[i]);
+                fences[i] = nullptr;
+                busy[i] = false;
+            }
+        }
+    }
+
+private:
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    size_t slot_bytes = 0;
+    int count = 0;
+    std::unique_ptr<std::atomic<bool>[]> busy;
+    std::vector<GLsync> fences; // Render thread only
+};
+
+// Called once the header is read with the image size; returns where the
+// bottom-up BGRA rows go (width * 4 bytes each, tightly packed) or nullptr
+// to give up, e.g. when no slot is large enough.
+typedef std::function<unsigned char*(int width, int height)> ReserveRows;
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+inline void jpegErrorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+}
+
+inline bool decodeJpegRows(const unsigned char* data, size_t size, const ReserveRows& reserve) {
+    jpeg_decompress_struct cinfo;
+    JpegError error;
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpegErrorExit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo); // No CMYK to BGRA in libjpeg, leave it to FreeImage
+        return false;
+    }
+    cinfo.out_color_space = JCS_EXT_BGRA; // libjpeg-turbo swizzles while converting
+    jpeg_start_decompress(&cinfo);
+
+    unsigned char* dst = reserve(cinfo.output_width, cinfo.output_height);
+    if (!dst) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    size_t pitch = size_t(cinfo.output_width) * 4;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = dst + (cinfo.output_height - 1 - cinfo.output_scanline) * pitch;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+struct PngSource {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+};
+
+inline void pngRead(png_structp png, png_bytep out, png_size_t length) {
+    PngSource* src = static_cast<PngSource*>(png_get_io_ptr(png));
+    if (src->offset + length > src->size)
+        png_error(png, "truncated");
+    std::memcpy(out, src->data + src->offset, length);
+    src->offset += length;
+}
+
+inline bool decodePngRows(const unsigned char* data, size_t size, const ReserveRows& reserve) {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png)
+        return false;
+    png_infop info = png_create_info_struct(png);
+    PngSource src = {data, size, 0};
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+
+    png_set_read_fn(png, &src, pngRead);
+    png_read_info(png, info);
+    png_uint_32 width = png_get_image_width(png, info);
+    png_uint_32 height = png_get_image_height(png, info);
+
+    // Everything becomes 8-bit BGRA on the way out of libpng
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_bgr(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    unsigned char* dst = reserve(width, height);
+    if (!dst) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+    }
+    size_t pitch = size_t(width) * 4;
+    for (int pass = 0; pass < passes; ++pass)
+        for (png_uint_32 y = 0; y < height; ++y)
+            png_read_row(png, dst + (height - 1 - y) * pitch, nullptr);
+    png_read_end(png, nullptr);
+    png_destroy_read_struct(&png, &info, nullptr);
+    return true;
+}
+
+// Picks the row decoder from the file signature. False for other formats
+// (WebP, TIFF, ...) and for anything the row decoders reject, so the
+// caller can fall back to FreeImage.
+inline bool decodeRows(const unsigned char* data, size_t size, const ReserveRows& reserve) {
+    static const unsigned char jpeg_magic[] = {0xFF, 0xD8, 0xFF};
+    static const unsigned char png_magic[] = {0x89, 'P', 'N', 'G'};
+    if (size > 4 && std::memcmp(data, jpeg_magic, sizeof(jpeg_magic)) == 0)
+        return decodeJpegRows(data, size, reserve);
+    if (size > 8 && std::memcmp(data, png_magic, sizeof(png_magic)) == 0)
+        return decodePngRows(data, size, reserve);
+    return false;
+}
+
+#endif // DIRECT_DECODE_H
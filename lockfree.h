@@ -0,0 +1,82 @@
+#ifndef LOCKFREE_H
+#define LOCKFREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Bounded single-producer/single-consumer ring buffer. push() is only
+// called from one thread and pop() from one other thread; neither blocks.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(const T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == Capacity)
+            return false; // Full
+        items[head & (Capacity - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false; // Empty
+        item = items[tail & (Capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+    alignas(64) std::atomic<size_t> head_{0}; // Written by the producer
+    alignas(64) std::atomic<size_t> tail_{0}; // Written by the consumer
+};
+
+// Latest-value cell for one writer and any number of readers. Readers get a
+// consistent snapshot without locking and retry if a write raced them.
+template <typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock needs a trivially copyable type");
+    static const size_t words = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+public:
+    explicit Seqlock(const T& value = T()) { store(value); }
+
+    void store(const T& value) {
+        uint32_t raw[words] = {};
+        std::memcpy(raw, &value, sizeof(T));
+        unsigned s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < words; ++i)
+            data[i].store(raw[i], std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint32_t raw[words];
+        unsigned before, after;
+        do {
+            before = seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < words; ++i)
+                raw[i] = data[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1));
+        T value;
+        std::memcpy(&value, raw, sizeof(T));
+        return value;
+    }
+
+private:
+    std::atomic<unsigned> seq{0};
+    std::atomic<uint32_t> data[words];
+};
+
+#endif // LOCKFREE_H
@@ -8,32 +8,221 @@
 #include <FreeImage.h>
 #include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <array>
 #include <cmath>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <semaphore.h>
+#include "page_io.h"
+#include "page_info.h"
+#include "tiled_texture.h"
+#include "lockfree.h"
+#include "direct_decode.h"
+#include "thumbnail_atlas.h"
+#include "pixel_pool.h"
+#include "mipmap.h"
+#include "dir_watch.h"
+#include "page_cache.h"
 
 namespace fs = std::filesystem;
 
 std::vector<std::string> pageFiles;
+std::vector<PageInfo> pageInfo; // Header of every page file, probed when the volume opens
 GLuint frontCoverTexture, backCoverTexture, spineTexture;
-GLuint leftPageTexture, rightPageTexture;
+GLuint leftShownTexture, rightShownTexture; // What renderBook draws: full pages or thumbnails
 int currentPage = 1;
-float angleX = 0.0f, angleY = 0.0f;
 GLfloat paper_depth = 0.001f;
 GLuint stack_texture;
 GLuint VAO, VBO, shaderProgram;
+GLuint tileVAO, tileVBO;
+GLuint sheetVAO, sheetVBO, sheetProgram;
+int windowWidth = 800, windowHeight = 600;
+int max_texture_size = 0;
 int bookSize;
 bool front_close = 0, back_close = 0;
+float spine_x, spine_y; // Front cover end of the spine, set by updateBookGeometry
+float leftPageRect[4], rightPageRect[4]; // x0, y0, x1, y1 of the page quads, also set there
 
-const char* vertexShaderSource = R"(
+// High-fidelity page block: every sheet is an instance of one thin bent
+// strip, placed by the vertex shader. Far away the flat stack quads are used.
+bool sheetsEnabled = false;
+const float sheet_lod_distance = 14.0f;
+const int sheet_bend_segments = 12;
+const float sheet_bend = 0.15f; // Part of the strip that curves out of the spine
+
+// Fast flip: while the arrow key repeats (or is tapped quickly) only
+// thumbnails are shown; full pages load once flipping has settled.
+const int thumbnail_size = 256;
+const size_t thumbnail_cache_max = 256;
+const Uint32 fast_flip_settle_ms = 150;
+std::unordered_map<std::string, GLuint> thumbnailCache;
+std::deque<std::string> thumbnailOrder;
+std::unordered_set<std::string> pendingThumbnails; // Requested from the loader, not back yet
+bool fastFlipping = false;
+Uint32 lastFlipTicks = 0;
+
+// Overview: every page of the volume as a grid of atlas thumbnails, drawn in
+// one instanced call. O toggles it, clicking a page opens its spread.
+bool overviewOpen = false;
+bool overviewStale = true; // overviewAtlas still holds another volume
+ThumbnailAtlas overviewAtlas;
+GLuint overviewProgram;
+float overviewCell = 160.0f; // Grid cell in window pixels, Ctrl+wheel zooms
+float overviewScroll = 0.0f;
+
+// Watch mode: the directory of the open volume is watched and the book
+// follows it as page files are added, rewritten or removed. Only changed
+// files are decoded again. W toggles it.
+bool watchEnabled = false;
+DirWatch volumeWatch;
+std::unordered_set<std::string> watchChanges; // Paths changed since the last reload
+Uint32 lastWatchEvent = 0;
+const Uint32 watch_settle_ms = 300; // Pages copied in together arrive as one reload
+
+// Stereo: both eyes come out of one pass over the book. Every draw is
+// instanced once per eye, the vertex shader picks the eye's view and moves
+// it into its half of the target; clip distances keep it there. Anaglyph
+// renders side by side offscreen and mixes the halves into the window.
+// 3 cycles the modes.
+enum StereoMode { STEREO_OFF, STEREO_SIDE_BY_SIDE, STEREO_TOP_BOTTOM, STEREO_ANAGLYPH };
+const char* stereo_mode_names[] = {"off", "side by side", "top and bottom", "anaglyph (red/cyan)"};
+StereoMode stereoMode = STEREO_OFF;
+struct StereoView {
+    glm::mat4 projection;
+    glm::mat4 view;     // Between the eyes, for tile selection
+    glm::mat4 views[2]; // Left, right
+    int eyes;           // Instances per draw
+    int split;          // 0 whole target, 1 left | right, 2 left over right
+    float shift;        // Frustum shift that puts the book at zero parallax
+};
+int stereoEyes = 1; // Of the frame being drawn
+GLuint anaglyphFBO, anaglyphColor, anaglyphDepth, anaglyphProgram;
+int anaglyphWidth = 0, anaglyphHeight = 0;
+
+// Pages larger than this are drawn through the tile pool instead of one texture
+const int tiled_page_min_size = 4096;
+TilePool tilePool(256, 8); // 256 tiles of 256x256 (64 MB), at most 8 uploads per frame
+
+// Full-resolution page held for one side of the spread
+struct SpreadPage {
+    int page = -1; // Index into pageFiles, -1 when empty
+    GLuint texture = 0;
+    TiledPage* tiled = nullptr;
+};
+SpreadPage leftPage, rightPage;
+int requestedPage = -1; // Spread whose full pages were last sent to the loader
+int shownPage = -1;     // Spread updatePageTextures last prepared
+
+// Threads: the SDL main thread only handles input and the window, the render
+// thread owns the GL context and a loader thread decodes pages. They talk
+// through single-producer/single-consumer queues; the camera is published
+// through a seqlock so dragging never waits on anything.
+struct Camera {
+    float angleX, angleY;
+    float distance;
+};
+Seqlock<Camera> camera(Camera{0.0f, 0.0f, 8.0f});
+
+enum CommandType { CMD_FLIP, CMD_RESIZE, CMD_TOGGLE_SHEETS, CMD_OVERVIEW, CMD_OVERVIEW_SCROLL, CMD_OVERVIEW_PICK, CMD_STEREO, CMD_WATCH, CMD_QUIT };
+struct Command {
+    CommandType type;
+    int a, b; // Flip: right arrow, key repeat. Resize: width, height. Scroll: wheel steps, zoom. Pick: x, y.
+};
+SpscQueue<Command, 256> commands; // Input -> render
+
+enum LoadKind {
+    LOAD_PAGE,      // Full page of the open volume
+    LOAD_THUMBNAIL, // Fast-flip preview
+    LOAD_COVER,     // Cover or spine of an adjacent volume, always plain pixels
+    LOAD_PREFETCH,  // Entry spread page of an adjacent volume
+    LOAD_CACHE,     // Page just ahead, decoded into pageCache while the loader is idle
+    LOAD_CACHE_COVER, // Image loadTexture decoded, put into pageCache at cover size when idle
+};
+struct LoadRequest {
+    std::string path;
+    int page;
+    LoadKind kind;
+    PageInfo info; // Unknown for pages of other volumes
+    unsigned generation = 0;
+};
+struct LoadedPage {
+    std::string path;
+    int page;
+    LoadKind kind;
+    PixelBuffer pixels; // Ready for glTexImage2D, back to pixelPool once uploaded
+    TiledPage* tiled;   // Set instead of pixels for oversized pages
+    int slot = -1;    // Or decoded straight into this uploadRing slot
+    int width = 0, height = 0;
+    int levels = 1;   // Mip levels in the slot
+    CachedPage cached{}; // Or mapped from pageCache, nothing was decoded
+    bool skipped = false; // The reader had left the page before the loader got to it
+    unsigned generation = 0; // pageGeneration of the request
+};
+SpscQueue<LoadRequest, 64> loadRequests; // Render -> loader
+SpscQueue<LoadedPage, 64> loadedPages;   // Loader -> render, "texture ready"
+sem_t loaderWake;
+std::atomic<bool> loaderRunning{true};
+std::atomic<int> targetPage{0}; // Spread the reader is on, lets the loader skip stale thumbnails
+unsigned pageGeneration = 0; // Render thread, bumped when the open volume is reloaded
+UploadRing uploadRing; // 4 slots of 40 MB, full pages are decoded straight into it
+PixelPool pixelPool(256 << 20); // Every other decoded page and thumbnail, keeps up to 256 MB idle
+std::atomic<int> mipFilter{MIP_SMOOTH}; // For pages the loader decodes from now on, M switches
+PageCache pageCache; // Decoded pages kept on disk, least recently used go past 2 GB
+const int cache_fill_spreads = 3; // Spreads ahead of the reader the loader puts in pageCache
+const size_t cache_fill_max = 32; // Pages waiting for the idle loader to put them in pageCache
+Uint32 titleEvent;
+
+// Series mode: the book directory may hold one subdirectory per volume (or
+// be a text file listing volume directories). Going past a closed cover
+// opens the neighbouring volume, whose covers and entry spread are decoded
+// in the background. Everything decoded ahead of time shares one budget.
+std::vector<std::string> volumes;
+int currentVolume = 0;
+const size_t min_volume_pages = 4; // Front cover, back cover, spine and a spread
+const size_t page_budget = 16; // Full pages held at once: the open spread, its covers and prefetched pages
+const size_t prefetch_capacity = page_budget - 5;
+std::unordered_map<std::string, LoadedPage> prefetched;
+std::unordered_set<std::string> prefetchWanted;
+std::unordered_set<std::string> pendingPrefetch;
+
+// Part of the vertex shaders that draw the book, see StereoView. Instance
+// `eye` of a draw is projected through views[eye] into its half.
+const std::string stereoEyeShaderSource = R"(
+    uniform mat4 projection;
+    uniform mat4 views[2];
+    uniform int split;
+    uniform float shift;
+    vec4 eyePosition(vec4 world, int eye) {
+        vec4 p = projection * views[eye] * world;
+        float side = eye == 0 ? -1.0 : 1.0;
+        p.x += side * shift * p.w;
+        gl_ClipDistance[0] = 1.0;
+        if (split == 1) {
+            gl_ClipDistance[0] = p.w + side * p.x;
+            p.x = 0.5 * (p.x + side * p.w);
+        } else if (split == 2) {
+            gl_ClipDistance[0] = p.w - side * p.y;
+            p.y = 0.5 * (p.y - side * p.w);
+        }
+        return p;
+    }
+)";
+
+const std::string vertexShaderSource = R"(
     #version 330 core
     layout(location = 0) in vec3 aPos;
     layout(location = 1) in vec2 aTexCoord;
     out vec2 TexCoord;
     uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    uniform vec2 texOffset;
+    uniform vec2 texScale;
+)" + stereoEyeShaderSource + R"(
     void main() {
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
-        TexCoord = aTexCoord;
+        gl_Position = eyePosition(model * vec4(aPos, 1.0), gl_InstanceID);
+        TexCoord = texOffset + aTexCoord * texScale;
     }
 )";
 
@@ -47,27 +236,423 @@ const char* fragmentShaderSource = R"(
     }
 )";
 
-GLuint loadTexture(const std::string& filename) {
-    FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(filename.c_str(), 0);
-    FIBITMAP* dib = FreeImage_Load(fif, filename.c_str());
-    dib = FreeImage_ConvertTo32Bits(dib);
+// aPos.x runs along the sheet from the spine (0) to the fore edge (1),
+// aPos.y is the page height. Sheets below rightSheets lie on the right pile.
+const std::string sheetVertexShaderSource = R"(
+    #version 330 core
+    layout(location = 0) in vec2 aPos;
+    flat out float Shade;
+    uniform mat4 model;
+    uniform vec2 spineFront;
+    uniform float pageZ;
+    uniform float bend;
+    uniform int sheets;
+    uniform int rightSheets;
+    uniform int firstSheet;
+    uniform int eyes;
+)" + stereoEyeShaderSource + R"(
+    void main() {
+        int sheet = firstSheet + gl_InstanceID / eyes;
+        bool right = sheet < rightSheets;
+        float t = (float(sheet) + 0.5) / float(sheets);
+        float u = right ? (float(sheet) + 0.5) / float(rightSheets)
+                        : (float(sheets - sheet) - 0.5) / float(sheets - rightSheets);
+        vec2 cover = right ? spineFront : -spineFront;
 
-    int width = FreeImage_GetWidth(dib);
-    int height = FreeImage_GetHeight(dib);
-    GLubyte* textureData = FreeImage_GetBits(dib);
+        vec2 spine = mix(spineFront, -spineFront, t);
+        vec2 inner = vec2(mix(cover.x, 0.0, u), mix(cover.y, pageZ, u));
+        vec2 outer = inner + vec2(right ? 1.0 : -1.0, 0.0);
 
+        vec2 p;
+        if (aPos.x < bend) {
+            float k = aPos.x / bend;
+            vec2 control = vec2(mix(spine.x, inner.x, 0.5), inner.y);
+            p = mix(mix(spine, control, k), mix(control, inner, k), k);
+        } else {
+            p = mix(inner, outer, (aPos.x - bend) / (1.0 - bend));
+        }
+        gl_Position = eyePosition(model * vec4(p.x, aPos.y, p.y, 1.0), gl_InstanceID % eyes);
+        Shade = 0.86 + 0.12 * fract(sin(float(sheet) * 12.9898) * 43758.5453);
+    }
+)";
+
+const char* sheetFragmentShaderSource = R"(
+    #version 330 core
+    flat in float Shade;
+    out vec4 FragColor;
+    void main() {
+        FragColor = vec4(vec3(0.97, 0.96, 0.92) * Shade, 1.0);
+    }
+)";
+
+// One instance per page. aPos is the unit quad; cells are laid out in
+// window pixels in reading order, right to left for rtl.
+const char* overviewVertexShaderSource = R"(
+    #version 330 core
+    layout(location = 0) in vec3 aPos;
+    out vec3 TexCoord;
+    flat out int Current;
+    uniform vec2 viewport;
+    uniform float cellSize;
+    uniform float scroll;
+    uniform int columns;
+    uniform int pages;
+    uniform int reverse;
+    uniform int mirror;
+    uniform int currentPage;
+    uniform int cellsPerSide;
+    void main() {
+        int i = gl_InstanceID;
+        int page = reverse != 0 ? pages - 1 - i : i;
+        int column = i % columns;
+        if (mirror != 0)
+            column = columns - 1 - column;
+        float margin = (viewport.x - float(columns) * cellSize) / 2.0;
+        vec2 corner = vec2(margin + float(column) * cellSize, float(i / columns) * cellSize - scroll);
+        vec2 p = corner + cellSize * (0.04 + 0.92 * vec2(aPos.x, 1.0 - aPos.y));
+        gl_Position = vec4(p.x / viewport.x * 2.0 - 1.0, 1.0 - p.y / viewport.y * 2.0, 0.0, 1.0);
+
+        int perLayer = cellsPerSide * cellsPerSide;
+        int cell = page % perLayer;
+        TexCoord = vec3((vec2(cell % cellsPerSide, cell / cellsPerSide) + aPos.xy) / float(cellsPerSide),
+                        float(page / perLayer));
+        Current = int(page == currentPage || page == currentPage + 1);
+    }
+)";
+
+const char* overviewFragmentShaderSource = R"(
+    #version 330 core
+    in vec3 TexCoord;
+    flat in int Current;
+    out vec4 FragColor;
+    uniform sampler2DArray atlas;
+    void main() {
+        vec4 c = texture(atlas, TexCoord);
+        // Pages not decoded yet and the letterbox margins stay grey
+        vec3 color = mix(vec3(0.2), c.rgb, c.a);
+        FragColor = vec4(Current != 0 ? color : color * 0.8, 1.0);
+    }
+)";
+
+// Full-window triangle over the side-by-side target. Red comes from the
+// left eye as grey, so the mostly black and white pages don't shimmer.
+const char* anaglyphVertexShaderSource = R"(
+    #version 330 core
+    out vec2 TexCoord;
+    void main() {
+        vec2 p = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4.0 - 1.0;
+        gl_Position = vec4(p, 0.0, 1.0);
+        TexCoord = (p + 1.0) / 2.0;
+    }
+)";
+
+const char* anaglyphFragmentShaderSource = R"(
+    #version 330 core
+    in vec2 TexCoord;
+    out vec4 FragColor;
+    uniform sampler2D eyes;
+    void main() {
+        vec3 left = texture(eyes, vec2(TexCoord.x * 0.5, TexCoord.y)).rgb;
+        vec3 right = texture(eyes, vec2(TexCoord.x * 0.5 + 0.5, TexCoord.y)).rgb;
+        FragColor = vec4(dot(left, vec3(0.299, 0.587, 0.114)), right.gb, 1.0);
+    }
+)";
+
+// Converts a decoded image to 32 bits in a pooled buffer, shrunk to the
+// largest size the driver accepts so the upload cannot fail. FreeImage
+// writes the converted rows straight into the buffer. Safe to call off the
+// GL thread.
+PixelBuffer toPixels(FIBITMAP* src) {
+    if (!src)
+        return PixelBuffer();
+    FIBITMAP* scaled = nullptr;
+    int width = FreeImage_GetWidth(src);
+    int height = FreeImage_GetHeight(src);
+    if (width > max_texture_size || height > max_texture_size) {
+        float fit = float(max_texture_size) / std::max(width, height);
+        width = std::max(1, int(width * fit));
+        height = std::max(1, int(height * fit));
+        src = scaled = FreeImage_Rescale(src, width, height, FILTER_BILINEAR);
+    }
+    FIBITMAP* standard = nullptr; // 16-bit and float images have no raw-bits path
+    if (src && FreeImage_GetImageType(src) != FIT_BITMAP)
+        src = standard = FreeImage_ConvertTo32Bits(src);
+
+    PixelBuffer pixels = src ? pixelPool.acquire(width, height, mipChainBytes(width, height)) : PixelBuffer();
+    if (pixels)
+        FreeImage_ConvertToRawBits(pixels.data, src, width * 4, 32,
+                                   FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+    FreeImage_Unload(standard);
+    FreeImage_Unload(scaled);
+    return pixels;
+}
+
+// Trilinear filtering. Textures that come without a mip chain, the few
+// decoded on the render thread, get theirs from the driver.
+void setTextureParameters(int levels) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (levels == 1)
+        glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+// Uploads pooled pixels and returns the buffer, glTexImage2D has copied it
+GLuint uploadTexture(PixelBuffer& pixels) {
     GLuint textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, textureData);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    texImageLevels(pixels.data, pixels.width, pixels.height, pixels.levels);
+    setTextureParameters(pixels.levels);
+    pixelPool.release(pixels);
+    return textureID;
+}
+
+// Uploads a page the loader decoded into an uploadRing slot
+GLuint uploadSlot(int slot, int width, int height, int levels) {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    uploadRing.upload(slot, width, height, levels);
+    setTextureParameters(levels);
+    return textureID;
+}
 
-    FreeImage_Unload(dib);
+// Uploads a page mapped from pageCache and unmaps it
+GLuint uploadCached(CachedPage& cached) {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    texImageLevels(cached.pixels, cached.width, cached.height, cached.levels);
+    setTextureParameters(cached.levels);
+    delete cached.file;
+    cached = CachedPage();
     return textureID;
 }
 
+// Fills the room reserved behind a decoded image with its mip chain and
+// returns the number of levels
+int addMipChain(unsigned char* data, int width, int height, MipFilter filter) {
+    buildMipChain(data, width, height, data + size_t(width) * height * 4, filter);
+    return mipLevels(width, height);
+}
+
+// Largest side a page of this kind is decoded for, part of its pageCache key
+int cacheTarget(LoadKind kind) {
+    if (kind == LOAD_COVER || kind == LOAD_CACHE_COVER)
+        return max_texture_size;
+    return std::min(tiled_page_min_size, max_texture_size);
+}
+
+bool requestLoad(const std::string& path, int page, LoadKind kind, const PageInfo& info = PageInfo()) {
+    if (!loadRequests.push(LoadRequest{path, page, kind, info, pageGeneration}))
+        return false;
+    sem_post(&loaderWake);
+    return true;
+}
+
+// Uploads straight from pageCache when the file is there, otherwise decodes
+// it and leaves filling the cache to the loader
+GLuint loadTexture(const std::string& filename) {
+    CachedPage cached = pageCache.find(filename, max_texture_size, MipFilter(mipFilter.load()));
+    if (cached)
+        return uploadCached(cached);
+    FIBITMAP* src = loadBitmap(filename);
+    PixelBuffer pixels = toPixels(src);
+    FreeImage_Unload(src);
+    if (pixels)
+        requestLoad(filename, -1, LOAD_CACHE_COVER);
+    return uploadTexture(pixels);
+}
+
+// Decodes a book page either into pooled texture pixels or, when it is too
+// large for that, into a tiled page streamed through tilePool. JPEG and PNG
+// pages go through the row decoders straight into the pooled buffer.
+// Runs on the loader thread.
+void decodePage(const std::string& filename, const PageInfo& info, PixelBuffer& pixels, TiledPage*& tiled) {
+    int limit = std::min(tiled_page_min_size, max_texture_size);
+    if (!info.rotated() && (int)info.width <= limit && (int)info.height <= limit) {
+        PageFile file(filename);
+        bool ok = file.valid() && decodeRows(file.data, file.size, [&](int width, int height) -> unsigned char* {
+            if (width > limit || height > limit)
+                return nullptr;
+            pixels = pixelPool.acquire(width, height, mipChainBytes(width, height));
+            return pixels.data;
+        });
+        if (ok)
+            return;
+        pixelPool.release(pixels);
+    }
+
+    FIBITMAP* src = loadBitmap(filename, info.rotated() ? JPEG_EXIFROTATE : 0);
+    if (!src)
+        return;
+    // The full-resolution 32-bit copy may not fit in memory for the huge
+    // scans tiling is for; those are shown downscaled instead
+    FIBITMAP* base = nullptr;
+    if ((int)FreeImage_GetWidth(src) > limit || (int)FreeImage_GetHeight(src) > limit)
+        base = FreeImage_ConvertTo32Bits(src);
+    if (base)
+        tiled = new TiledPage(base, tilePool);
+    else
+        pixels = toPixels(src);
+    FreeImage_Unload(src);
+}
+
+// Decodes a JPEG or PNG page row by row into a free uploadRing slot. Fails
+// for other formats, oversized or rotated pages or a full ring, leaving the
+// page to decodePage.
+bool decodePageToSlot(const std::string& filename, const PageInfo& info, LoadedPage& loaded) {
+    int limit = std::min(tiled_page_min_size, max_texture_size);
+    if (!uploadRing.available() || info.rotated() || (int)info.width > limit || (int)info.height > limit)
+        return false;
+    PageFile file(filename);
+    if (!file.valid())
+        return false;
+
+    bool ok = decodeRows(file.data, file.size, [&](int width, int height) -> unsigned char* {
+        if (width > limit || height > limit)
+            return nullptr;
+        loaded.slot = uploadRing.acquire(size_t(width) * height * 4 + mipChainBytes(width, height));
+        loaded.width = width;
+        loaded.height = height;
+        return loaded.slot >= 0 ? uploadRing.data(loaded.slot) : nullptr;
+    });
+    if (!ok && loaded.slot >= 0) {
+        uploadRing.release(loaded.slot);
+        loaded.slot = -1;
+    }
+    return ok;
+}
+
+PixelBuffer decodeThumbnail(const std::string& filename, const PageInfo& info) {
+    FIBITMAP* src = loadBitmap(filename, info.rotated() ? JPEG_EXIFROTATE : 0, thumbnail_size);
+    FIBITMAP* thumb = FreeImage_MakeThumbnail(src, thumbnail_size);
+    PixelBuffer pixels = toPixels(thumb ? thumb : src);
+    FreeImage_Unload(thumb);
+    FreeImage_Unload(src);
+    return pixels;
+}
+
+void cacheThumbnail(const std::string& filename, GLuint textureID) {
+    if (thumbnailOrder.size() >= thumbnail_cache_max) {
+        GLuint oldest = thumbnailCache[thumbnailOrder.front()];
+        glDeleteTextures(1, &oldest);
+        thumbnailCache.erase(thumbnailOrder.front());
+        thumbnailOrder.pop_front();
+    }
+    thumbnailCache[filename] = textureID;
+    thumbnailOrder.push_back(filename);
+}
+
+// Decodes a page into pageCache, so it opens from there the next time: one
+// just ahead of the reader (LOAD_CACHE), or one that was decoded cold and
+// handed over without waiting for the disk. Loader thread, when nothing
+// else is waiting.
+void fillCache(const LoadRequest& request) {
+    int target = cacheTarget(request.kind);
+    MipFilter filter = MipFilter(mipFilter.load());
+    bool cover = request.kind == LOAD_COVER || request.kind == LOAD_CACHE_COVER;
+    bool tiled_page = !cover && request.info.known() &&
+                      ((int)request.info.width > target || (int)request.info.height > target);
+    bool passed = request.kind == LOAD_CACHE && std::abs(request.page - targetPage) > 2 * cache_fill_spreads + 1;
+    if (tiled_page || passed || pageCache.contains(request.path, target, filter))
+        return;
+    PixelBuffer pixels;
+    TiledPage* tiled = nullptr;
+    if (cover) {
+        FIBITMAP* src = loadBitmap(request.path);
+        pixels = toPixels(src);
+        FreeImage_Unload(src);
+    } else {
+        decodePage(request.path, request.info, pixels, tiled);
+    }
+    if (pixels) {
+        pixels.levels = addMipChain(pixels.data, pixels.width, pixels.height, filter);
+        pageCache.store(request.path, target, filter, pixels.data, pixels.width, pixels.height, pixels.levels);
+    }
+    pixelPool.release(pixels);
+    delete tiled;
+}
+
+void loaderThread() {
+    LoadRequest request;
+    std::deque<LoadRequest> fills; // Pages to put into pageCache, oldest first
+    auto addFill = [&](const LoadRequest& fill) {
+        if (fills.size() >= cache_fill_max)
+            fills.pop_front();
+        fills.push_back(fill);
+    };
+    while (loaderRunning) {
+        if (fills.empty())
+            sem_wait(&loaderWake);
+        while (loadRequests.pop(request)) {
+            if (request.kind == LOAD_CACHE || request.kind == LOAD_CACHE_COVER) {
+                addFill(request);
+                continue;
+            }
+            LoadedPage loaded{request.path, request.page, request.kind, PixelBuffer(), nullptr};
+            loaded.generation = request.generation;
+            int target = cacheTarget(request.kind);
+            MipFilter filter = MipFilter(mipFilter.load());
+            // Pages and thumbnails of spreads the reader has already left
+            // are answered empty so the render thread can ask again later.
+            // Thumbnails stay out of pageCache, the thumbnail atlas keeps them.
+            int distance = std::abs(request.page - targetPage);
+            bool stale = (request.kind == LOAD_THUMBNAIL && distance > 2) || (request.kind == LOAD_PAGE && distance > 1);
+            loaded.skipped = stale;
+            if (!stale && request.kind != LOAD_THUMBNAIL)
+                loaded.cached = pageCache.find(request.path, target, filter);
+            if (stale || loaded.cached) {
+                // Nothing to decode
+            } else if (request.kind == LOAD_PAGE) {
+                if (!decodePageToSlot(request.path, request.info, loaded))
+                    decodePage(request.path, request.info, loaded.pixels, loaded.tiled);
+            } else if (request.kind == LOAD_PREFETCH) {
+                // Prefetched pages may wait a long time, keep them out of the ring
+                decodePage(request.path, request.info, loaded.pixels, loaded.tiled);
+            } else if (request.kind == LOAD_COVER) {
+                FIBITMAP* src = loadBitmap(request.path);
+                loaded.pixels = toPixels(src);
+                FreeImage_Unload(src);
+            } else {
+                loaded.pixels = decodeThumbnail(request.path, request.info);
+            }
+            if (loaded.pixels)
+                loaded.pixels.levels = addMipChain(loaded.pixels.data, loaded.pixels.width, loaded.pixels.height, filter);
+            else if (loaded.slot >= 0)
+                loaded.levels = addMipChain(uploadRing.data(loaded.slot), loaded.width, loaded.height, filter);
+            // Shown first, written to pageCache once the loader is idle
+            if (request.kind != LOAD_THUMBNAIL && (loaded.pixels || loaded.slot >= 0))
+                addFill(request);
+            while (!loadedPages.push(loaded)) {
+                if (!loaderRunning) {
+                    pixelPool.release(loaded.pixels);
+                    delete loaded.tiled;
+                    delete loaded.cached.file;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        // Nothing else asked for: one page into the cache, then look again
+        if (!fills.empty()) {
+            fillCache(fills.front());
+            fills.pop_front();
+        }
+    }
+}
+
+void freeLoaded(LoadedPage& loaded) {
+    pixelPool.release(loaded.pixels);
+    delete loaded.tiled;
+    delete loaded.cached.file;
+    loaded.cached = CachedPage();
+    if (loaded.slot >= 0)
+        uploadRing.release(loaded.slot);
+    loaded.tiled = nullptr;
+    loaded.slot = -1;
+}
+
 void deleteTexture(GLuint textureID) {
     if (textureID != 0) {
         glDeleteTextures(1, &textureID);
@@ -85,10 +670,41 @@ void initGeometry() {
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
+
+    // Unit quad the tiles of large pages are drawn with
+    const float tile_quad[] = {
+        0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+        1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+        1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+        0.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+    };
+    glGenVertexArrays(1, &tileVAO);
+    glBindVertexArray(tileVAO);
+    glGenBuffers(1, &tileVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, tileVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tile_quad), tile_quad, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    // One sheet as a triangle strip, finely divided where it bends
+    std::vector<float> sheet;
+    for (int i = 0; i <= sheet_bend_segments + 1; ++i) {
+        float s = i <= sheet_bend_segments ? sheet_bend * i / sheet_bend_segments : 1.0f;
+        sheet.insert(sheet.end(), {s, -1.0f, s, 1.0f});
+    }
+    glGenVertexArrays(1, &sheetVAO);
+    glBindVertexArray(sheetVAO);
+    glGenBuffers(1, &sheetVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, sheetVBO);
+    glBufferData(GL_ARRAY_BUFFER, sheet.size() * sizeof(float), sheet.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
     glBindVertexArray(0);
 }
 
-GLuint createShaderProgram() {
+GLuint createShaderProgram(const char* vertexShaderSource, const char* fragmentShaderSource) {
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
     glCompileShader(vertexShader);
@@ -107,6 +723,26 @@ GLuint createShaderProgram() {
     return program;
 }
 
+// Fits a page into its half of the spread by the aspect from its header,
+// against the spine and centred vertically. The model matrix stretches
+// each half to 4x6, so pages of any other shape are letterboxed. Closed
+// covers (page -1) fill the whole half.
+void fitPage(int page, bool left, float rect[4]) {
+    const float slot_aspect = 4.0f / 6.0f;
+    float w = 1.0f, h = 1.0f;
+    if (page >= 0 && page < (int)pageInfo.size() && pageInfo[page].known()) {
+        float aspect = pageInfo[page].aspect();
+        if (aspect > slot_aspect)
+            h = slot_aspect / aspect;
+        else
+            w = aspect / slot_aspect;
+    }
+    rect[0] = left ? -w : 0.0f;
+    rect[1] = -h;
+    rect[2] = left ? 0.0f : w;
+    rect[3] = h;
+}
+
 void updateBookGeometry(int currentPage) {
     float spine_size = bookSize * paper_depth;
     float radius = spine_size / 2;
@@ -116,6 +752,12 @@ void updateBookGeometry(int currentPage) {
     float y = radius * sin(radian);
     float x_rev = -x; // x_rev = radius * cos(radian + M_PI)
     float y_rev = -y; // y_rev = radius * sin(radian + M_PI)
+    spine_x = x;
+    spine_y = y;
+    fitPage(front_close ? -1 : currentPage, true, leftPageRect);
+    fitPage(back_close ? -1 : currentPage + 1, false, rightPageRect);
+    const float* l = leftPageRect;
+    const float* r = rightPageRect;
 
     std::vector<float> vertices;
 
@@ -138,16 +780,16 @@ void updateBookGeometry(int currentPage) {
     vertices.insert(vertices.end(), {1.0f + x, 1.0f, y, 0.0f, 1.0f});
 
     // Left page
-    vertices.insert(vertices.end(), {-1.0f, -1.0f, spine_size / 2, 0.0f, 0.0f});
-    vertices.insert(vertices.end(), {0.0f, -1.0f, spine_size / 2, 1.0f, 0.0f});
-    vertices.insert(vertices.end(), {0.0f, 1.0f, spine_size / 2, 1.0f, 1.0f});
-    vertices.insert(vertices.end(), {-1.0f, 1.0f, spine_size / 2, 0.0f, 1.0f});
+    vertices.insert(vertices.end(), {l[0], l[1], spine_size / 2, 0.0f, 0.0f});
+    vertices.insert(vertices.end(), {l[2], l[1], spine_size / 2, 1.0f, 0.0f});
+    vertices.insert(vertices.end(), {l[2], l[3], spine_size / 2, 1.0f, 1.0f});
+    vertices.insert(vertices.end(), {l[0], l[3], spine_size / 2, 0.0f, 1.0f});
 
     // Right page
-    vertices.insert(vertices.end(), {0.0f, -1.0f, spine_size / 2, 0.0f, 0.0f});
-    vertices.insert(vertices.end(), {1.0f, -1.0f, spine_size / 2, 1.0f, 0.0f});
-    vertices.insert(vertices.end(), {1.0f, 1.0f, spine_size / 2, 1.0f, 1.0f});
-    vertices.insert(vertices.end(), {0.0f, 1.0f, spine_size / 2, 0.0f, 1.0f});
+    vertices.insert(vertices.end(), {r[0], r[1], spine_size / 2, 0.0f, 0.0f});
+    vertices.insert(vertices.end(), {r[2], r[1], spine_size / 2, 1.0f, 0.0f});
+    vertices.insert(vertices.end(), {r[2], r[3], spine_size / 2, 1.0f, 1.0f});
+    vertices.insert(vertices.end(), {r[0], r[3], spine_size / 2, 0.0f, 1.0f});
 
     // Left stack
     vertices.insert(vertices.end(), {-1.0f, -1.0f, spine_size / 2, 0.0f, 0.0f});
@@ -189,93 +831,834 @@ void updateBookGeometry(int currentPage) {
     glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_DYNAMIC_DRAW);
 }
 
-void loadImages(const std::string& directory, const std::string& direction) {
-    for (const auto& entry : fs::directory_iterator(directory)) {
-        pageFiles.push_back(entry.path().string());
+// Page files directly in a directory, 0 when it can't be read
+size_t countPages(const std::string& directory) {
+    size_t count = 0;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(directory, error))
+        if (entry.is_regular_file())
+            count++;
+    return count;
+}
+
+// Volume directories of a series, in reading order. A directory with page
+// files of its own is a single book, whatever subdirectories it also has.
+// Volumes too small to make a book are left out.
+std::vector<std::string> findVolumes(const std::string& path) {
+    std::vector<std::string> found;
+    if (fs::is_regular_file(path)) {
+        // A list of volume directories, one per line
+        std::ifstream list(path);
+        std::string line;
+        while (std::getline(list, line))
+            if (!line.empty())
+                found.push_back(line);
+    } else if (countPages(path) > 0) {
+        found.push_back(path);
+    } else {
+        for (const auto& entry : fs::directory_iterator(path))
+            if (entry.is_directory())
+                found.push_back(entry.path().string());
+        std::sort(found.begin(), found.end());
     }
-    std::sort(pageFiles.begin(), pageFiles.end());
+    found.erase(std::remove_if(found.begin(), found.end(), [](const std::string& volume) {
+        return countPages(volume) < min_volume_pages;
+    }), found.end());
+    return found;
+}
+
+// Page files of a volume in the order pageFiles keeps them for `direction`
+std::vector<std::string> volumePages(const std::string& directory, const std::string& direction) {
+    std::vector<std::string> files;
+    for (const auto& entry : fs::directory_iterator(directory))
+        if (entry.is_regular_file())
+            files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    if (direction == "ltr")
+        std::reverse(files.begin(), files.end());
+    return files;
+}
 
-    frontCoverTexture = loadTexture(pageFiles[0]);
-    backCoverTexture = loadTexture(pageFiles[pageFiles.size() - 2]);
-    spineTexture = loadTexture(pageFiles[pageFiles.size() - 1]);
+// Front cover, back cover and spine: the first file and the last two by name
+std::array<std::string, 3> coverFiles(const std::vector<std::string>& files, const std::string& direction) {
+    size_t n = files.size();
+    if (direction == "ltr")
+        return {files[n - 1], files[1], files[0]};
+    return {files[0], files[n - 2], files[n - 1]};
+}
 
-    if(direction == "ltr"){
-        std::sort(pageFiles.begin(), pageFiles.end(), std::greater<std::string>());
-        currentPage = pageFiles.size()-3;
+// First spread in reading order, or the last one when `atEnd`
+int entryPage(int size, bool atEnd, const std::string& direction) {
+    bool rtl = direction == "rtl";
+    int page = rtl ? 1 : size - 3;
+    if (atEnd) {
+        if (rtl)
+            while (page < size - 3) page += 2;
+        else
+            while (page > 2) page -= 2;
     }
+    return page;
+}
 
-    leftPageTexture = loadTexture(pageFiles[currentPage]);
-    rightPageTexture = loadTexture(pageFiles[currentPage+1]);
-    stack_texture = loadTexture("stack.png");
+// Uploads a cover decoded ahead of time, or decodes it now
+GLuint takeCoverTexture(const std::string& path) {
+    auto it = prefetched.find(path);
+    if (it == prefetched.end() || (!it->second.pixels && !it->second.cached))
+        return loadTexture(path);
+    GLuint textureID = it->second.cached ? uploadCached(it->second.cached) : uploadTexture(it->second.pixels);
+    freeLoaded(it->second);
+    prefetched.erase(it);
+    return textureID;
+}
+
+void releasePage(SpreadPage& side) {
+    deleteTexture(side.texture);
+    delete side.tiled;
+    side = SpreadPage();
+}
+
+// Moves a prefetched page of the open volume onto one side of the spread
+bool takePrefetched(int page, SpreadPage& side) {
+    auto it = prefetched.find(pageFiles[page]);
+    if (it == prefetched.end())
+        return false;
+    releasePage(side);
+    side.page = page;
+    side.tiled = it->second.tiled;
+    if (it->second.cached)
+        side.texture = uploadCached(it->second.cached);
+    else if (it->second.pixels)
+        side.texture = uploadTexture(it->second.pixels);
+    prefetched.erase(it);
+    return true;
+}
 
+// Asks the loader for the covers and entry spreads of the neighbouring
+// volumes and drops whatever was decoded for volumes no longer adjacent.
+// page_budget counts pages, so pages large enough to be tiled, which keep
+// their full-resolution base in memory, are left until the volume opens.
+void prefetchAdjacentVolumes(const std::string& direction) {
+    int limit = std::min(tiled_page_min_size, max_texture_size);
+    std::vector<std::pair<std::string, LoadKind>> wanted;
+    for (int step : {1, -1}) {
+        int volume = currentVolume + step;
+        if (volume < 0 || volume >= (int)volumes.size())
+            continue;
+        std::vector<std::string> files = volumePages(volumes[volume], direction);
+        if (files.size() < min_volume_pages)
+            continue;
+        for (const std::string& cover : coverFiles(files, direction))
+            wanted.push_back({cover, LOAD_COVER});
+        int entry = entryPage(files.size(), step < 0, direction);
+        for (int page : {entry, entry + 1}) {
+            PageInfo info = probePage(files[page]);
+            if (info.known() && (int)info.width <= limit && (int)info.height <= limit)
+                wanted.push_back({files[page], LOAD_PREFETCH});
+        }
+    }
+
+    prefetchWanted.clear();
+    for (const auto& w : wanted)
+        prefetchWanted.insert(w.first);
+    for (auto it = prefetched.begin(); it != prefetched.end();) {
+        if (prefetchWanted.count(it->first)) {
+            ++it;
+        } else {
+            freeLoaded(it->second);
+            it = prefetched.erase(it);
+        }
+    }
+
+    for (const auto& w : wanted) {
+        if (prefetched.count(w.first) || pendingPrefetch.count(w.first))
+            continue;
+        if (prefetched.size() + pendingPrefetch.size() >= prefetch_capacity)
+            break;
+        if (requestLoad(w.first, -1, w.second))
+            pendingPrefetch.insert(w.first);
+    }
+}
+
+void openVolume(int volume, bool atEnd, const std::string& direction) {
+    currentVolume = volume;
+    pageFiles = volumePages(volumes[volume], direction);
+    pageInfo = probePages(pageFiles);
     bookSize = pageFiles.size();
+    overviewStale = true;
+
+    std::array<std::string, 3> covers = coverFiles(pageFiles, direction);
+    deleteTexture(frontCoverTexture);
+    deleteTexture(backCoverTexture);
+    deleteTexture(spineTexture);
+    frontCoverTexture = takeCoverTexture(covers[0]);
+    backCoverTexture = takeCoverTexture(covers[1]);
+    spineTexture = takeCoverTexture(covers[2]);
+
+    currentPage = entryPage(bookSize, atEnd, direction);
+    front_close = back_close = false;
+    releasePage(leftPage);
+    releasePage(rightPage);
+    leftShownTexture = rightShownTexture = 0; // Deleted just above
+    requestedPage = -1;
+    shownPage = -1;
+    takePrefetched(currentPage, leftPage);
+    takePrefetched(currentPage + 1, rightPage);
+
+    updateBookGeometry(currentPage);
+    prefetchAdjacentVolumes(direction);
+    watchChanges.clear();
+    if (watchEnabled)
+        volumeWatch.start(volumes[volume]);
+}
+
+// Moves currentPage one spread to the right or left. Only page state and
+// geometry change here; textures follow in updatePageTextures, so a burst
+// of key repeats collapses into a single target page.
+void flipPage(bool right, const std::string& direction, bool repeat) {
+    // Pages are sorted in reverse for ltr, so the right arrow walks the
+    // index down there and up for rtl. Flipping past a closed cover moves
+    // to the neighbouring volume of a series.
+    bool rtl = direction == "rtl";
+    if (right == rtl) {
+        int volume = currentVolume + (rtl ? 1 : -1);
+        if (currentPage < bookSize-3)
+            currentPage += 2;
+        else if (front_close && volume >= 0 && volume < (int)volumes.size())
+            return openVolume(volume, !rtl, direction);
+        else
+            front_close = !front_close;
+    } else {
+        int volume = currentVolume + (rtl ? -1 : 1);
+        if (currentPage > (rtl ? 1 : 2))
+            currentPage -= 2;
+        else if (back_close && volume >= 0 && volume < (int)volumes.size())
+            return openVolume(volume, rtl, direction);
+        else
+            back_close = !back_close;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    fastFlipping = fastFlipping || repeat || now - lastFlipTicks < fast_flip_settle_ms;
+    lastFlipTicks = now;
+    updateBookGeometry(currentPage);
+}
+
+// Opens the spread that shows pageFiles[page]
+void jumpToPage(int page, const std::string& direction) {
+    bool rtl = direction == "rtl";
+    int first = rtl ? 1 : entryPage(bookSize, true, direction);
+    int last = rtl ? entryPage(bookSize, true, direction) : bookSize - 3;
+    currentPage = std::clamp(page, first, last);
+    currentPage -= (currentPage - first) % 2;
+    front_close = back_close = false;
+    updateBookGeometry(currentPage);
 }
 
-void renderBook(GLuint shader) {
-    glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(angleX), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(angleY), glm::vec3(0.0f, 1.0f, 0.0f));
+// Takes the pages the loader has finished and uploads the ones still wanted
+void receiveLoadedPages() {
+    LoadedPage loaded;
+    while (loadedPages.pop(loaded)) {
+        if ((loaded.kind == LOAD_PAGE || loaded.kind == LOAD_THUMBNAIL) && loaded.generation != pageGeneration) {
+            freeLoaded(loaded); // Decoded before reloadVolume, maybe from an old file
+            continue;
+        }
+        if (loaded.kind == LOAD_THUMBNAIL) {
+            pendingThumbnails.erase(loaded.path);
+            if (loaded.cached && !thumbnailCache.count(loaded.path))
+                cacheThumbnail(loaded.path, uploadCached(loaded.cached));
+            else if (loaded.pixels && !thumbnailCache.count(loaded.path))
+                cacheThumbnail(loaded.path, uploadTexture(loaded.pixels));
+            freeLoaded(loaded);
+            continue;
+        }
+        if (loaded.kind == LOAD_COVER || loaded.kind == LOAD_PREFETCH) {
+            pendingPrefetch.erase(loaded.path);
+            if (prefetchWanted.count(loaded.path) && !prefetched.count(loaded.path) && !loaded.tiled &&
+                prefetched.size() < prefetch_capacity)
+                prefetched[loaded.path] = loaded;
+            else
+                freeLoaded(loaded);
+            continue;
+        }
+
+        bool current = loaded.page < bookSize && loaded.path == pageFiles[loaded.page];
+        SpreadPage* side = !current || loaded.skipped ? nullptr
+                         : loaded.page == currentPage ? &leftPage
+                         : loaded.page == currentPage + 1 ? &rightPage : nullptr;
+        if (!side) {
+            // The reader has moved on, ask again if they come back
+            if (loaded.page == requestedPage || loaded.page == requestedPage + 1)
+                requestedPage = -1;
+            freeLoaded(loaded);
+            continue;
+        }
+        releasePage(*side);
+        side->page = loaded.page;
+        side->tiled = loaded.tiled;
+        if (loaded.slot >= 0)
+            side->texture = uploadSlot(loaded.slot, loaded.width, loaded.height, loaded.levels);
+        else if (loaded.cached)
+            side->texture = uploadCached(loaded.cached);
+        else if (loaded.pixels)
+            side->texture = uploadTexture(loaded.pixels);
+    }
+}
+
+// Returns the cached thumbnail of a page, asking the loader for it if
+// `request` and needed
+GLuint thumbnail(int page, bool request) {
+    auto it = thumbnailCache.find(pageFiles[page]);
+    if (it != thumbnailCache.end())
+        return it->second;
+    if (request && !pendingThumbnails.count(pageFiles[page]) &&
+        requestLoad(pageFiles[page], page, LOAD_THUMBNAIL, pageInfo[page]))
+        pendingThumbnails.insert(pageFiles[page]);
+    return 0;
+}
+
+// Has the loader put the next spreads in reading order into pageCache
+void requestCacheFill(const std::string& direction) {
+    int step = direction == "rtl" ? 2 : -2;
+    for (int s = 1; s <= cache_fill_spreads; ++s)
+        for (int page = currentPage + step * s; page < currentPage + step * s + 2; ++page)
+            if (page >= 0 && page < bookSize)
+                requestLoad(pageFiles[page], page, LOAD_CACHE, pageInfo[page]);
+}
+
+// Called once per frame: shows thumbnails while flipping fast and loads the
+// full-resolution spread once the reader has settled on it.
+void updatePageTextures(const std::string& direction) {
+    uploadRing.reclaim();
+    receiveLoadedPages();
+    if (fastFlipping && SDL_GetTicks() - lastFlipTicks >= fast_flip_settle_ms)
+        fastFlipping = false;
+    if (shownPage != currentPage) {
+        targetPage = currentPage;
+        prefetchPages(pageFiles, currentPage, direction == "rtl" ? 2 : -2);
+    }
+    shownPage = currentPage;
+
+    if (leftPage.page != currentPage)
+        takePrefetched(currentPage, leftPage);
+    if (rightPage.page != currentPage + 1)
+        takePrefetched(currentPage + 1, rightPage);
+    if (leftPage.page == currentPage && rightPage.page == currentPage + 1) {
+        leftShownTexture = leftPage.texture;
+        rightShownTexture = rightPage.texture;
+        return;
+    }
+
+    if (!fastFlipping && requestedPage != currentPage) {
+        // Only the missing side, a side kept by reloadVolume stays
+        bool requested = leftPage.page == currentPage ||
+                         requestLoad(pageFiles[currentPage], currentPage, LOAD_PAGE, pageInfo[currentPage]);
+        requested = requested && (rightPage.page == currentPage + 1 ||
+                                  requestLoad(pageFiles[currentPage + 1], currentPage + 1, LOAD_PAGE, pageInfo[currentPage + 1]));
+        if (requested) {
+            requestedPage = currentPage;
+            requestCacheFill(direction);
+        }
+    }
+    // Until the full pages arrive, show thumbnails (or keep the last spread).
+    // After a settled flip the full pages are already queued ahead of any
+    // thumbnail, so only the ones cached while flipping fast are used.
+    GLuint left = leftPage.page == currentPage ? leftPage.texture : thumbnail(currentPage, fastFlipping);
+    GLuint right = rightPage.page == currentPage + 1 ? rightPage.texture : thumbnail(currentPage + 1, fastFlipping);
+    if (left || leftPage.page == currentPage)
+        leftShownTexture = left;
+    if (right || rightPage.page == currentPage + 1)
+        rightShownTexture = right;
+}
+
+// Eyes a comfortable 1/30 of the viewing distance apart, with their
+// frusta shifted so the book sits at screen depth
+StereoView makeStereoView(const Camera& cam) {
+    StereoView stereo;
+    stereo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, cam.distance), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    stereo.split = stereoMode == STEREO_OFF ? 0 : stereoMode == STEREO_TOP_BOTTOM ? 2 : 1;
+    stereo.eyes = stereoMode == STEREO_OFF ? 1 : 2;
+    float aspect = (float)windowWidth / windowHeight;
+    if (stereoMode == STEREO_SIDE_BY_SIDE)
+        aspect /= 2;
+    else if (stereoMode == STEREO_TOP_BOTTOM)
+        aspect *= 2;
+    stereo.projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+
+    float eye = stereo.eyes == 2 ? cam.distance / 60 : 0.0f;
+    stereo.views[0] = glm::translate(glm::mat4(1.0f), glm::vec3(eye, 0.0f, 0.0f)) * stereo.view;
+    stereo.views[1] = glm::translate(glm::mat4(1.0f), glm::vec3(-eye, 0.0f, 0.0f)) * stereo.view;
+    stereo.shift = stereo.projection[0][0] * eye / cam.distance;
+    return stereo;
+}
+
+void setStereoUniforms(GLuint program, const StereoView& stereo) {
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, &stereo.projection[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(program, "views"), 2, GL_FALSE, &stereo.views[0][0][0]);
+    glUniform1i(glGetUniformLocation(program, "split"), stereo.split);
+    glUniform1f(glGetUniformLocation(program, "shift"), stereo.shift);
+    stereoEyes = stereo.eyes;
+}
+
+// One quad of the bound VAO, once per eye
+void drawQuad(int first) {
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, first, 4, stereoEyes);
+}
+
+// Draws the visible tiles of a large page covering `rect` (x0, y0, x1, y1) at depth z
+void drawTiledPage(GLuint shader, TiledPage* page, const glm::mat4& model, const glm::mat4& viewProjection,
+                   const float rect[4], float z) {
+    float x0 = rect[0], y0 = rect[1], x1 = rect[2], y1 = rect[3];
+    std::vector<TileDraw> draws;
+    page->collect(viewProjection * model, windowWidth, windowHeight, x0, x1, y0, y1, z, draws);
+
+    glBindVertexArray(tileVAO);
+    for (const TileDraw& d : draws) {
+        glm::mat4 tile = glm::translate(model, glm::vec3(x0 + (x1 - x0) * d.rect[0], y0 + (y1 - y0) * d.rect[1], z));
+        tile = glm::scale(tile, glm::vec3((x1 - x0) * (d.rect[2] - d.rect[0]), (y1 - y0) * (d.rect[3] - d.rect[1]), 1.0f));
+        glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, &tile[0][0]);
+        glUniform2fv(glGetUniformLocation(shader, "texOffset"), 1, d.tex_offset);
+        glUniform2fv(glGetUniformLocation(shader, "texScale"), 1, d.tex_scale);
+        glBindTexture(GL_TEXTURE_2D, d.texture);
+        drawQuad(0);
+    }
+
+    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, &model[0][0]);
+    glUniform2f(glGetUniformLocation(shader, "texOffset"), 0.0f, 0.0f);
+    glUniform2f(glGetUniformLocation(shader, "texScale"), 1.0f, 1.0f);
+    glBindVertexArray(VAO);
+}
+
+// Draws every sheet of the page block in one instanced call. Sheets on the
+// side of a closed cover are left out, like the stack quads.
+void drawSheets(const glm::mat4& model, const StereoView& stereo) {
+    int sheets = std::max(2, (bookSize - 3) / 2);
+    int rightSheets = std::clamp(int(std::lround(sheets * (1.0f - float(currentPage) / bookSize))), 1, sheets - 1);
+    int first = front_close ? rightSheets : 0;
+    int last = back_close ? rightSheets : sheets;
+    if (first >= last)
+        return;
+
+    glUseProgram(sheetProgram);
+    setStereoUniforms(sheetProgram, stereo);
+    glUniformMatrix4fv(glGetUniformLocation(sheetProgram, "model"), 1, GL_FALSE, &model[0][0]);
+    glUniform2f(glGetUniformLocation(sheetProgram, "spineFront"), spine_x, spine_y);
+    // Keep the top sheets just under the page quads
+    glUniform1f(glGetUniformLocation(sheetProgram, "pageZ"), bookSize * paper_depth / 2 - paper_depth);
+    glUniform1f(glGetUniformLocation(sheetProgram, "bend"), sheet_bend);
+    glUniform1i(glGetUniformLocation(sheetProgram, "sheets"), sheets);
+    glUniform1i(glGetUniformLocation(sheetProgram, "rightSheets"), rightSheets);
+    glUniform1i(glGetUniformLocation(sheetProgram, "firstSheet"), first);
+    glUniform1i(glGetUniformLocation(sheetProgram, "eyes"), stereo.eyes);
+    glBindVertexArray(sheetVAO);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 2 * (sheet_bend_segments + 2), (last - first) * stereo.eyes);
+}
+
+void renderBook(GLuint shader, const Camera& cam, const StereoView& stereo) {
+    glm::mat4 viewProjection = stereo.projection * stereo.view;
+    glm::mat4 model = glm::rotate(glm::mat4(1.0f), glm::radians(cam.angleX), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(cam.angleY), glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::scale(model, glm::vec3(4,3,2));
 
     glUseProgram(shader);
+    setStereoUniforms(shader, stereo);
     glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, &model[0][0]);
+    glUniform2f(glGetUniformLocation(shader, "texOffset"), 0.0f, 0.0f);
+    glUniform2f(glGetUniformLocation(shader, "texScale"), 1.0f, 1.0f);
     glBindVertexArray(VAO);
     glActiveTexture(GL_TEXTURE0);
     glUniform1i(glGetUniformLocation(shader, "texture1"), 0);
+    tilePool.beginFrame();
+    float page_z = bookSize * paper_depth / 2;
 
     // Spine
     glBindTexture(GL_TEXTURE_2D, spineTexture);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    drawQuad(0);
 
     // Back cover
     if(!back_close){
         glBindTexture(GL_TEXTURE_2D, backCoverTexture);
-        glDrawArrays(GL_TRIANGLE_FAN, 4, 4);
+        drawQuad(4);
     }
 
     // Front cover
     if(!front_close){
         glBindTexture(GL_TEXTURE_2D, frontCoverTexture);
-        glDrawArrays(GL_TRIANGLE_FAN, 8, 4);
+        drawQuad(8);
     }
 
     // Left page
     if(!front_close)
-        glBindTexture(GL_TEXTURE_2D, leftPageTexture);
+        glBindTexture(GL_TEXTURE_2D, leftShownTexture);
     else
         glBindTexture(GL_TEXTURE_2D, frontCoverTexture);
-    if(!back_close)
-        glDrawArrays(GL_TRIANGLE_FAN, 12, 4);
+    if(!back_close){
+        if(!front_close && leftShownTexture == 0 && leftPage.tiled)
+            drawTiledPage(shader, leftPage.tiled, model, viewProjection, leftPageRect, page_z);
+        else
+            drawQuad(12);
+    }
 
     // Right page
     if(!back_close)
-        glBindTexture(GL_TEXTURE_2D, rightPageTexture);
+        glBindTexture(GL_TEXTURE_2D, rightShownTexture);
     else
         glBindTexture(GL_TEXTURE_2D, backCoverTexture);
-    if(!front_close)
-        glDrawArrays(GL_TRIANGLE_FAN, 16, 4);
+    if(!front_close){
+        if(!back_close && rightShownTexture == 0 && rightPage.tiled)
+            drawTiledPage(shader, rightPage.tiled, model, viewProjection, rightPageRect, page_z);
+        else
+            drawQuad(16);
+    }
+
+    if(sheetsEnabled && cam.distance < sheet_lod_distance){
+        drawSheets(model, stereo);
+        return;
+    }
 
     // Stacks
     glBindTexture(GL_TEXTURE_2D, stack_texture);
     if(!back_close){
-        glDrawArrays(GL_TRIANGLE_FAN, 20, 4); // Left stack
-        glDrawArrays(GL_TRIANGLE_FAN, 36, 4); // Top left stack
-        glDrawArrays(GL_TRIANGLE_FAN, 40, 4); // Bottm left stack
+        drawQuad(20); // Left stack
+        drawQuad(36); // Top left stack
+        drawQuad(40); // Bottm left stack
     }
     if(!front_close){
-        glDrawArrays(GL_TRIANGLE_FAN, 24, 4); // Right stack
-        glDrawArrays(GL_TRIANGLE_FAN, 28, 4); // Top right stack
-        glDrawArrays(GL_TRIANGLE_FAN, 32, 4); // Bottom right stack
+        drawQuad(24); // Right stack
+        drawQuad(28); // Top right stack
+        drawQuad(32); // Bottom right stack
+    }
+
+}
+
+int overviewColumns() {
+    return std::max(1, int(windowWidth / overviewCell));
+}
+
+void clampOverviewScroll() {
+    int rows = (bookSize + overviewColumns() - 1) / overviewColumns();
+    overviewScroll = std::clamp(overviewScroll, 0.0f, std::max(0.0f, rows * overviewCell - windowHeight));
+}
+
+// Grid position of a page counted in reading order, pageFiles run against
+// it for ltr
+int overviewIndex(int page, const std::string& direction) {
+    return direction == "rtl" ? page : bookSize - 1 - page;
+}
+
+// Page under a window position, or -1
+int overviewPageAt(int x, int y, const std::string& direction) {
+    int columns = overviewColumns();
+    float margin = (windowWidth - columns * overviewCell) / 2;
+    int column = int(std::floor((x - margin) / overviewCell));
+    int row = int(std::floor((y + overviewScroll) / overviewCell));
+    if (column < 0 || column >= columns || row < 0)
+        return -1;
+    if (direction == "rtl")
+        column = columns - 1 - column;
+    int index = row * columns + column;
+    return index < bookSize ? overviewIndex(index, direction) : -1;
+}
+
+void showOverview(const std::string& direction) {
+    overviewOpen = true;
+    if (overviewStale) {
+        overviewAtlas.open(pageFiles, pageInfo);
+        overviewStale = false;
+    }
+    // Start with the open spread in the middle of the window
+    int row = overviewIndex(currentPage, direction) / overviewColumns();
+    overviewScroll = (row + 0.5f) * overviewCell - windowHeight / 2.0f;
+    clampOverviewScroll();
+}
+
+void drawOverview(const std::string& direction) {
+    overviewAtlas.update();
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(overviewProgram);
+    glUniform2f(glGetUniformLocation(overviewProgram, "viewport"), windowWidth, windowHeight);
+    glUniform1f(glGetUniformLocation(overviewProgram, "cellSize"), overviewCell);
+    glUniform1f(glGetUniformLocation(overviewProgram, "scroll"), overviewScroll);
+    glUniform1i(glGetUniformLocation(overviewProgram, "columns"), overviewColumns());
+    glUniform1i(glGetUniformLocation(overviewProgram, "pages"), bookSize);
+    glUniform1i(glGetUniformLocation(overviewProgram, "reverse"), direction != "rtl");
+    glUniform1i(glGetUniformLocation(overviewProgram, "mirror"), direction == "rtl");
+    glUniform1i(glGetUniformLocation(overviewProgram, "currentPage"), currentPage);
+    glUniform1i(glGetUniformLocation(overviewProgram, "cellsPerSide"), ThumbnailAtlas::cells_per_side);
+    glUniform1i(glGetUniformLocation(overviewProgram, "atlas"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, overviewAtlas.texture());
+    glBindVertexArray(tileVAO);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, bookSize);
+    glBindVertexArray(VAO);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Brings the open volume up to date with its directory after watchChanges.
+// Textures of unchanged files stay, following their file to its new index,
+// and the spread stays on the page it showed. Returns false, changing
+// nothing, while the directory holds too few files for a book.
+bool reloadVolume(const std::string& direction) {
+    std::vector<std::string> files = volumePages(volumes[currentVolume], direction);
+    if (files.size() < min_volume_pages)
+        return false;
+    auto changed = [](const std::string& file) { return watchChanges.count(file) > 0; };
+    auto indexOf = [&](const std::string& file) {
+        return int(std::find(files.begin(), files.end(), file) - files.begin());
+    };
+
+    for (auto it = thumbnailOrder.begin(); it != thumbnailOrder.end();) {
+        if (changed(*it)) {
+            deleteTexture(thumbnailCache[*it]);
+            thumbnailCache.erase(*it);
+            it = thumbnailOrder.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pageGeneration++;
+    pendingThumbnails.clear();
+    for (const std::string& file : watchChanges) {
+        auto it = prefetched.find(file);
+        if (it != prefetched.end()) {
+            freeLoaded(it->second);
+            prefetched.erase(it);
+        }
+    }
+
+    std::unordered_map<std::string, PageInfo> known;
+    for (size_t i = 0; i < pageFiles.size(); ++i)
+        known[pageFiles[i]] = pageInfo[i];
+    std::vector<PageInfo> info(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        auto it = known.find(files[i]);
+        info[i] = it != known.end() && !changed(files[i]) ? it->second : probePage(files[i]);
+    }
+
+    for (SpreadPage* side : {&leftPage, &rightPage}) {
+        if (side->page < 0)
+            continue;
+        const std::string& file = pageFiles[side->page];
+        if (changed(file) || indexOf(file) == (int)files.size())
+            releasePage(*side);
+        else
+            side->page = indexOf(file);
+    }
+
+    std::array<std::string, 3> oldCovers = coverFiles(pageFiles, direction);
+    std::array<std::string, 3> covers = coverFiles(files, direction);
+    GLuint* coverTextures[3] = {&frontCoverTexture, &backCoverTexture, &spineTexture};
+    for (int i = 0; i < 3; ++i) {
+        if (covers[i] != oldCovers[i] || changed(covers[i])) {
+            deleteTexture(*coverTextures[i]);
+            *coverTextures[i] = takeCoverTexture(covers[i]);
+        }
+    }
+
+    std::string shown = pageFiles[currentPage];
+    bool frontClosed = front_close, backClosed = back_close;
+    pageFiles = files;
+    pageInfo = info;
+    bookSize = files.size();
+    int page = indexOf(shown);
+    jumpToPage(page < bookSize ? page : std::min(currentPage, bookSize - 1), direction);
+    // A page added or removed before the spread shifts its parity, the
+    // kept textures move to the side that shows their page now
+    if (leftPage.page == currentPage + 1 || rightPage.page == currentPage)
+        std::swap(leftPage, rightPage);
+    front_close = frontClosed;
+    back_close = backClosed;
+    updateBookGeometry(currentPage);
+
+    leftShownTexture = rightShownTexture = 0; // May have been deleted above
+    requestedPage = -1;
+    shownPage = -1;
+    overviewStale = true;
+    if (overviewOpen) {
+        // Rebuilt in place, the grid stays where the reader scrolled it
+        overviewAtlas.open(pageFiles, pageInfo);
+        overviewStale = false;
+        clampOverviewScroll();
     }
+    return true;
+}
 
+// Anaglyph frames are drawn side by side into a target twice the window's
+// width, each eye at full window resolution
+void bindAnaglyphTarget() {
+    if (!anaglyphFBO) {
+        glGenFramebuffers(1, &anaglyphFBO);
+        glGenTextures(1, &anaglyphColor);
+        glGenRenderbuffers(1, &anaglyphDepth);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, anaglyphFBO);
+    if (anaglyphWidth != windowWidth * 2 || anaglyphHeight != windowHeight) {
+        anaglyphWidth = windowWidth * 2;
+        anaglyphHeight = windowHeight;
+        glBindTexture(GL_TEXTURE_2D, anaglyphColor);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, anaglyphWidth, anaglyphHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, anaglyphColor, 0);
+        glBindRenderbuffer(GL_RENDERBUFFER, anaglyphDepth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, anaglyphWidth, anaglyphHeight);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, anaglyphDepth);
+    }
+    glViewport(0, 0, anaglyphWidth, anaglyphHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
-void set_win_title(int currentPage, int bookSize, SDL_Window* window, std::string direction){
+void drawAnaglyph() {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowWidth, windowHeight);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(anaglyphProgram);
+    glUniform1i(glGetUniformLocation(anaglyphProgram, "eyes"), 0);
+    glBindTexture(GL_TEXTURE_2D, anaglyphColor);
+    glBindVertexArray(tileVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(VAO);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Window calls belong on the main thread, so the title is handed over as an event
+void set_win_title(int currentPage, int bookSize, std::string direction){
     std::string title = "3D Book Viewer";
     if(direction == "rtl")
         title = "3D Book Viewer - Page " + std::to_string(currentPage) + " - " + std::to_string(currentPage+1) + " / " + std::to_string(bookSize);
     else if(direction == "ltr")
         title = "3D Book Viewer - Page " + std::to_string(abs(currentPage-bookSize)) + " - " + std::to_string(abs(currentPage-1-bookSize)) + " / " + std::to_string(bookSize );
-    SDL_SetWindowTitle(window, title.c_str());
+    if(volumes.size() > 1)
+        title += " - Volume " + std::to_string(currentVolume + 1) + " / " + std::to_string(volumes.size());
+    SDL_Event event = {};
+    event.type = titleEvent;
+    event.user.data1 = new std::string(title);
+    SDL_PushEvent(&event);
+}
+
+void renderThread(SDL_Window* window, SDL_GLContext context, std::string direction) {
+    SDL_GL_MakeCurrent(window, context);
+    glewInit();
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    uploadRing.create(4, 40 << 20);
+
+    glEnable(GL_DEPTH_TEST);
+    shaderProgram = createShaderProgram(vertexShaderSource.c_str(), fragmentShaderSource);
+    sheetProgram = createShaderProgram(sheetVertexShaderSource.c_str(), sheetFragmentShaderSource);
+    overviewProgram = createShaderProgram(overviewVertexShaderSource, overviewFragmentShaderSource);
+    anaglyphProgram = createShaderProgram(anaglyphVertexShaderSource, anaglyphFragmentShaderSource);
+    initGeometry();
+    stack_texture = loadTexture("stack.png");
+    openVolume(0, false, direction);
+    set_win_title(currentPage, bookSize, direction);
+
+    std::thread loader(loaderThread);
+
+    bool running = true;
+    while (running) {
+        Command command;
+        while (commands.pop(command)) {
+            switch (command.type) {
+                case CMD_FLIP:
+                    flipPage(command.a, direction, command.b);
+                    set_win_title(currentPage, bookSize, direction);
+                    break;
+                case CMD_RESIZE:
+                    windowWidth = command.a;
+                    windowHeight = command.b;
+                    glViewport(0, 0, windowWidth, windowHeight);
+                    break;
+                case CMD_TOGGLE_SHEETS:
+                    sheetsEnabled = !sheetsEnabled;
+                    break;
+                case CMD_OVERVIEW:
+                    if (overviewOpen)
+                        overviewOpen = false;
+                    else
+                        showOverview(direction);
+                    break;
+                case CMD_OVERVIEW_SCROLL:
+                    if (command.b)
+                        overviewCell = std::clamp(overviewCell * std::pow(1.1f, float(command.a)), 64.0f, 512.0f);
+                    else
+                        overviewScroll -= command.a * overviewCell / 2;
+                    clampOverviewScroll();
+                    break;
+                case CMD_OVERVIEW_PICK: {
+                    overviewOpen = false;
+                    int page = overviewPageAt(command.a, command.b, direction);
+                    if (page >= 0) {
+                        jumpToPage(page, direction);
+                        set_win_title(currentPage, bookSize, direction);
+                    }
+                    break;
+                }
+                case CMD_WATCH:
+                    watchEnabled = !watchEnabled && volumeWatch.start(volumes[currentVolume]);
+                    if (!watchEnabled)
+                        volumeWatch.stop();
+                    watchChanges.clear();
+                    std::cout << (watchEnabled ? "Watching " : "Not watching ") << volumes[currentVolume] << std::endl;
+                    break;
+                case CMD_STEREO:
+                    stereoMode = StereoMode((stereoMode + 1) % 4);
+                    std::cout << "Stereo: " << stereo_mode_names[stereoMode] << std::endl;
+                    break;
+                case CMD_QUIT:
+                    running = false;
+                    break;
+            }
+        }
+
+        if (volumeWatch.poll(watchChanges))
+            lastWatchEvent = SDL_GetTicks();
+        if (!watchChanges.empty() && SDL_GetTicks() - lastWatchEvent >= watch_settle_ms) {
+            if (reloadVolume(direction)) {
+                watchChanges.clear();
+                set_win_title(currentPage, bookSize, direction);
+            } else {
+                lastWatchEvent = SDL_GetTicks(); // Try again once more files are in
+            }
+        }
+        updatePageTextures(direction);
+
+        Camera cam = camera.load();
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (overviewOpen) {
+            drawOverview(direction);
+            SDL_GL_SwapWindow(window);
+            continue;
+        }
+        StereoView stereo = makeStereoView(cam);
+        if (stereoMode == STEREO_ANAGLYPH)
+            bindAnaglyphTarget();
+        if (stereo.split)
+            glEnable(GL_CLIP_DISTANCE0);
+        renderBook(shaderProgram, cam, stereo);
+        glDisable(GL_CLIP_DISTANCE0);
+        if (stereoMode == STEREO_ANAGLYPH)
+            drawAnaglyph();
+        SDL_GL_SwapWindow(window);
+    }
+
+    loaderRunning = false;
+    sem_post(&loaderWake);
+    loader.join();
+    overviewAtlas.close();
+    SDL_GL_MakeCurrent(window, nullptr);
+}
+
+void printPoolStats() {
+    PixelPool::Stats stats = pixelPool.stats();
+    std::cout << "Pixel pool: " << stats.allocations << " allocations, " << stats.reuses << " reuses, "
+              << stats.trims << " trims, " << (stats.bytes_in_use >> 20) << " MB in use, "
+              << (stats.bytes_idle >> 20) << " MB idle, " << (stats.peak_bytes >> 20) << " MB peak" << std::endl;
+}
+
+void sendCommand(CommandType type, int a = 0, int b = 0) {
+    while (!commands.push(Command{type, a, b}))
+        SDL_Delay(1);
 }
 
 int main(int argc, char** argv) {
@@ -286,147 +1669,142 @@ int main(int argc, char** argv) {
     std::string directory = argv[1];
     std::string direction = (argc > 2) ? argv[2] : "ltr";
     //int page_num = (argc > 3) ? std::stoi(argv[3]) : -1;
+    if (fs::exists(directory))
+        volumes = findVolumes(directory);
+    if (volumes.empty()) {
+        std::cerr << "No book with at least " << min_volume_pages << " pages in " << directory << std::endl;
+        return -1;
+    }
 
     SDL_Init(SDL_INIT_VIDEO);
     SDL_Window* window = SDL_CreateWindow("3D Book Viewer", SDL_WINDOWPOS_CENTERED,
                                           SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_OPENGL  | SDL_WINDOW_RESIZABLE);
     SDL_GLContext context = SDL_GL_CreateContext(window);
+    SDL_GL_MakeCurrent(window, nullptr); // Handed over to the render thread
 
-    glewInit();
     FreeImage_Initialise();
-
-    glEnable(GL_DEPTH_TEST);
-    shaderProgram = createShaderProgram();
-    initGeometry();
-    loadImages(directory, direction);
-
-    updateBookGeometry(currentPage);
+    sem_init(&loaderWake, 0, 0);
+    titleEvent = SDL_RegisterEvents(1);
 
     std::string title = "3D Book Viewer";
     SDL_SetWindowTitle(window, title.c_str());
 
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f/600.0f, 0.1f, 100.0f);
-    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 8.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::thread render(renderThread, window, context, direction);
 
+    Camera cam = camera.load();
     bool running = true;
     SDL_Event event;
     int lastX = 0, lastY = 0;
     bool mouseDown = false;
+    bool overview = false; // Mirrors overviewOpen, the grid takes the mouse
 
-    while (running) {
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT: running = false; break;
-                case SDL_WINDOWEVENT:
-                    if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                        int width = event.window.data1;
-                        int height = event.window.data2;
-                        glViewport(0, 0, width, height);
-                        projection = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 100.0f);
-                    }
-                    break;
-                case SDL_MOUSEBUTTONDOWN:
-                    if (event.button.button == SDL_BUTTON_LEFT) {
-                        mouseDown = true;
-                        lastX = event.button.x;
-                        lastY = event.button.y;
-                    }
-                    break;
-                case SDL_MOUSEBUTTONUP:
-                    if (event.button.button == SDL_BUTTON_LEFT) mouseDown = false;
-                    break;
-                case SDL_MOUSEMOTION:
-                    if (mouseDown) {
-                        angleY += (event.motion.x - lastX) * 0.5f;
-                        angleX += (event.motion.y - lastY) * 0.5f;
-                        lastX = event.motion.x;
-                        lastY = event.motion.y;
-                    }
-                    break;
-                case SDL_MOUSEWHEEL:
-                    if (event.wheel.y > 0) { // Прокрутка вверх - приближение
-                        view = glm::translate(view, glm::vec3(0.0f, 0.0f, 0.1f));
-                    } else if (event.wheel.y < 0) { // Прокрутка вниз - отдаление
-                        view = glm::translate(view, glm::vec3(0.0f, 0.0f, -0.1f));
-                    }
+    while (running && SDL_WaitEvent(&event)) {
+        if (event.type == titleEvent) {
+            std::string* newTitle = static_cast<std::string*>(event.user.data1);
+            SDL_SetWindowTitle(window, newTitle->c_str());
+            delete newTitle;
+            continue;
+        }
+        switch (event.type) {
+            case SDL_QUIT: running = false; break;
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_RESIZED)
+                    sendCommand(CMD_RESIZE, event.window.data1, event.window.data2);
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+                if (overview && event.button.button == SDL_BUTTON_LEFT) {
+                    sendCommand(CMD_OVERVIEW_PICK, event.button.x, event.button.y);
+                    overview = false;
+                } else if (event.button.button == SDL_BUTTON_LEFT) {
+                    mouseDown = true;
+                    lastX = event.button.x;
+                    lastY = event.button.y;
+                }
+                break;
+            case SDL_MOUSEBUTTONUP:
+                if (event.button.button == SDL_BUTTON_LEFT) mouseDown = false;
+                break;
+            case SDL_MOUSEMOTION:
+                if (mouseDown) {
+                    cam.angleY += (event.motion.x - lastX) * 0.5f;
+                    cam.angleX += (event.motion.y - lastY) * 0.5f;
+                    lastX = event.motion.x;
+                    lastY = event.motion.y;
+                    camera.store(cam);
+                }
+                break;
+            case SDL_MOUSEWHEEL:
+                if (overview) {
+                    sendCommand(CMD_OVERVIEW_SCROLL, event.wheel.y, (SDL_GetModState() & KMOD_CTRL) != 0);
                     break;
-                case SDL_KEYDOWN:{
-                    switch (event.key.keysym.sym) {
-                        case SDLK_RIGHT:
-                            if(direction == "rtl"){
-                                if(currentPage < bookSize-3)
-                                    currentPage += 2;
-                                else
-                                    front_close=!front_close;
-                            }
-
-                            if (direction == "ltr"){
-                                if(currentPage > 2)
-                                    currentPage -= 2;
-                                else
-                                    back_close=!back_close;
-                            }
-
-                            deleteTexture(leftPageTexture);
-                            deleteTexture(rightPageTexture);
-                            leftPageTexture = loadTexture(pageFiles[currentPage]);
-                            rightPageTexture = loadTexture(pageFiles[currentPage + 1]);
-                            updateBookGeometry(currentPage);
-                            set_win_title(currentPage, bookSize, window, direction);
-                            break;
-                        case SDLK_LEFT:
-                            if(direction == "rtl"){
-                                if(currentPage > 1)
-                                    currentPage -= 2;
-                                else
-                                    back_close=!back_close;
-                            }
-
-                            if(direction == "ltr"){
-                                if(currentPage < bookSize-3)
-                                    currentPage += 2;
-                                else
-                                    front_close=!front_close;
-                            }
-
-                            deleteTexture(leftPageTexture);
-                            deleteTexture(rightPageTexture);
-                            leftPageTexture = loadTexture(pageFiles[currentPage]);
-                            rightPageTexture = loadTexture(pageFiles[currentPage + 1]);
-                            updateBookGeometry(currentPage);
-                            set_win_title(currentPage, bookSize, window, direction);
-                            break;
-                        case SDLK_UP:
-                            angleX = 0.0f;
-                            angleY = 0.0f;
-                            break;
-                        case SDLK_f:
-                            if (SDL_GetWindowFlags(window) & SDL_WINDOW_FULLSCREEN) {
-                                SDL_SetWindowFullscreen(window, 0); // exit fullscreen mode
-                            } else {
-                                SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN); // Enter fullscreen mode
-                            }
-                            break;
-                        case SDLK_ESCAPE:
-                            running=false;
-                            break;
-                    }
                 }
+                if (event.wheel.y > 0) { // Прокрутка вверх - приближение
+                    cam.distance -= 0.1f;
+                } else if (event.wheel.y < 0) { // Прокрутка вниз - отдаление
+                    cam.distance += 0.1f;
+                }
+                camera.store(cam);
                 break;
+            case SDL_KEYDOWN:{
+                switch (event.key.keysym.sym) {
+                    case SDLK_RIGHT:
+                    case SDLK_LEFT:
+                        sendCommand(CMD_FLIP, event.key.keysym.sym == SDLK_RIGHT, event.key.repeat);
+                        break;
+                    case SDLK_UP:
+                        cam.angleX = 0.0f;
+                        cam.angleY = 0.0f;
+                        camera.store(cam);
+                        break;
+                    case SDLK_s:
+                        sendCommand(CMD_TOGGLE_SHEETS);
+                        break;
+                    case SDLK_p:
+                        printPoolStats();
+                        break;
+                    case SDLK_m:
+                        mipFilter = mipFilter == MIP_SMOOTH ? MIP_SHARP : MIP_SMOOTH;
+                        std::cout << (mipFilter == MIP_SHARP ? "Sharp" : "Smooth")
+                                  << " mipmaps for pages loaded from now on" << std::endl;
+                        break;
+                    case SDLK_3:
+                        sendCommand(CMD_STEREO);
+                        break;
+                    case SDLK_w:
+                        sendCommand(CMD_WATCH);
+                        break;
+                    case SDLK_o:
+                        overview = !overview;
+                        sendCommand(CMD_OVERVIEW);
+                        break;
+                    case SDLK_f:
+                        if (SDL_GetWindowFlags(window) & SDL_WINDOW_FULLSCREEN) {
+                            SDL_SetWindowFullscreen(window, 0); // exit fullscreen mode
+                        } else {
+                            SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN); // Enter fullscreen mode
+                        }
+                        break;
+                    case SDLK_ESCAPE:
+                        if (overview) {
+                            overview = false;
+                            sendCommand(CMD_OVERVIEW);
+                        } else {
+                            running=false;
+                        }
+                        break;
+                }
             }
+            break;
         }
-
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(shaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, &projection[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, &view[0][0]);
-        renderBook(shaderProgram);
-        SDL_GL_SwapWindow(window);
     }
 
+    sendCommand(CMD_QUIT);
+    render.join();
+
     SDL_GL_DeleteContext(context);
     SDL_DestroyWindow(window);
     SDL_Quit();
     FreeImage_DeInitialise();
+    sem_destroy(&loaderWake);
     return 0;
 }
@@ -0,0 +1,287 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIPMAP_X86 1
+#endif
+
+// CPU mip chains for page textures, built by whoever decoded the page so
+// the GL thread only uploads. Pixels are 8-bit with alpha in the fourth
+// byte (BGRA or RGBA) and sRGB-encoded colour. Levels are filtered in
+// linear light, so thin dark lines stay as dark as they look at full size
+// instead of greying out. The filter kernels have SSE2 and AVX2 versions
+// next to the plain C++ one.
+
+enum MipFilter {
+    MIP_SMOOTH, // 2x2 box, the usual mipmap
+    MIP_SHARP,  // 4x4 Catmull-Rom, keeps line art and screentone crisp
+};
+
+inline int mipLevels(int width, int height) {
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+// Size of levels 1 and up, stored tightly packed one after the other
+inline size_t mipChainBytes(int width, int height) {
+    size_t bytes = 0;
+    while (width > 1 || height > 1) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        bytes += size_t(width) * height * 4;
+    }
+    return bytes;
+}
+
+namespace mip_detail {
+
+struct Tables {
+    uint16_t to_linear[256];
+    uint8_t to_srgb[4096]; // Indexed by the top 12 bits of a linear value
+
+    Tables() {
+        for (int i = 0; i < 256; ++i) {
+            double c = i / 255.0;
+            double l = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            to_linear[i] = uint16_t(std::lround(l * 65535.0));
+        }
+        for (int i = 0; i < 4096; ++i) {
+            double l = (i + 0.5) / 4096.0;
+            double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+            to_srgb[i] = uint8_t(std::lround(std::min(1.0, c) * 255.0));
+        }
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+inline void decodeRow(const uint8_t* src, uint16_t* dst, int width) {
+    const Tables& t = tables();
+    for (int i = 0; i < width * 4; i += 4) {
+        dst[i] = t.to_linear[src[i]];
+        dst[i + 1] = t.to_linear[src[i + 1]];
+        dst[i + 2] = t.to_linear[src[i + 2]];
+        dst[i + 3] = src[i + 3] * 257; // Alpha is already linear
+    }
+}
+
+inline void encodeRow(const uint16_t* src, uint8_t* dst, int width) {
+    const Tables& t = tables();
+    for (int i = 0; i < width * 4; i += 4) {
+        dst[i] = t.to_srgb[src[i] >> 4];
+        dst[i + 1] = t.to_srgb[src[i + 1] >> 4];
+        dst[i + 2] = t.to_srgb[src[i + 2] >> 4];
+        dst[i + 3] = (src[i + 3] + 128) / 257;
+    }
+}
+
+// Vertical pass: folds the source rows of one output row into `out`.
+// Smooth sums rows b and c; sharp weighs a, b, c, d by -1, 9, 9, -1.
+inline void verticalScalar(const uint16_t* a, const uint16_t* b, const uint16_t* c, const uint16_t* d,
+                           int32_t* out, int begin, int end, MipFilter filter) {
+    for (int i = begin; i < end; ++i)
+        out[i] = filter == MIP_SHARP ? 9 * (b[i] + c[i]) - (a[i] + d[i]) : b[i] + c[i];
+}
+
+inline uint16_t clampLinear(int32_t v) {
+    return uint16_t(std::min(65535, std::max(0, v)));
+}
+
+// Horizontal pass for one output pixel, taps clamped to the row
+inline void horizontalPixel(const int32_t* v, int src_width, uint16_t* out, int x, MipFilter filter) {
+    int x0 = std::max(0, 2 * x - 1), x1 = std::min(src_width - 1, 2 * x);
+    int x2 = std::min(src_width - 1, 2 * x + 1), x3 = std::min(src_width - 1, 2 * x + 2);
+    for (int c = 0; c < 4; ++c) {
+        int32_t inner = v[x1 * 4 + c] + v[x2 * 4 + c];
+        if (filter == MIP_SHARP)
+            out[x * 4 + c] = clampLinear((9 * inner - (v[x0 * 4 + c] + v[x3 * 4 + c]) + 128) >> 8);
+        else
+            out[x * 4 + c] = uint16_t((inner + 2) >> 2);
+    }
+}
+
+#ifdef MIPMAP_X86
+inline int verticalSse2(const uint16_t* a, const uint16_t* b, const uint16_t* c, const uint16_t* d,
+                        int32_t* out, int count, MipFilter filter) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i B = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i C = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        __m128i lo = _mm_add_epi32(_mm_unpacklo_epi16(B, zero), _mm_unpacklo_epi16(C, zero));
+        __m128i hi = _mm_add_epi32(_mm_unpackhi_epi16(B, zero), _mm_unpackhi_epi16(C, zero));
+        if (filter == MIP_SHARP) {
+            __m128i A = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i D = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i));
+            __m128i outer_lo = _mm_add_epi32(_mm_unpacklo_epi16(A, zero), _mm_unpacklo_epi16(D, zero));
+            __m128i outer_hi = _mm_add_epi32(_mm_unpackhi_epi16(A, zero), _mm_unpackhi_epi16(D, zero));
+            lo = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(lo, 3), lo), outer_lo);
+            hi = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(hi, 3), hi), outer_hi);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), hi);
+    }
+    return i;
+}
+
+// One BGRA pixel of int32 lanes per register; the bias around packs_epi32
+// turns its signed saturation into the 0..65535 clamp
+inline int horizontalSse2(const int32_t* v, int src_width, uint16_t* out, int x, int x_end, MipFilter filter) {
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(short(0x8000));
+    for (; x < x_end && 2 * x + 2 < src_width; ++x) {
+        const int32_t* p = v + (2 * x - 1) * 4;
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+        __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+        __m128i inner = _mm_add_epi32(p1, p2);
+        __m128i r;
+        if (filter == MIP_SHARP) {
+            __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+            r = _mm_sub_epi32(_mm_add_epi32(_mm_slli_epi32(inner, 3), inner), _mm_add_epi32(p0, p3));
+            r = _mm_srai_epi32(_mm_add_epi32(r, _mm_set1_epi32(128)), 8);
+        } else {
+            r = _mm_srai_epi32(_mm_add_epi32(inner, _mm_set1_epi32(2)), 2);
+        }
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(r, bias), _mm_setzero_si128()), flip);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), packed);
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+inline int verticalAvx2(const uint16_t* a, const uint16_t* b, const uint16_t* c, const uint16_t* d,
+                        int32_t* out, int count, MipFilter filter) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i B = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m256i C = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i)));
+        __m256i r = _mm256_add_epi32(B, C);
+        if (filter == MIP_SHARP) {
+            __m256i A = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+            __m256i D = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)));
+            r = _mm256_sub_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(9)), _mm256_add_epi32(A, D));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+    }
+    return i;
+}
+
+// Two output pixels per iteration from three loads of two source pixels:
+// L0 = (2x-1, 2x), L1 = (2x+1, 2x+2), L2 = (2x+3, 2x+4)
+__attribute__((target("avx2")))
+inline int horizontalAvx2(const int32_t* v, int src_width, uint16_t* out, int x, int x_end, MipFilter filter) {
+    for (; x + 1 < x_end && 2 * x + 4 < src_width; x += 2) {
+        const int32_t* p = v + (2 * x - 1) * 4;
+        __m256i L0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i L1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 8));
+        __m256i L2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16));
+        __m256i inner = _mm256_add_epi32(_mm256_permute2x128_si256(L0, L1, 0x31), _mm256_permute2x128_si256(L1, L2, 0x20));
+        __m256i r;
+        if (filter == MIP_SHARP) {
+            __m256i outer = _mm256_add_epi32(_mm256_permute2x128_si256(L0, L1, 0x20), _mm256_permute2x128_si256(L1, L2, 0x31));
+            r = _mm256_sub_epi32(_mm256_mullo_epi32(inner, _mm256_set1_epi32(9)), outer);
+            r = _mm256_srai_epi32(_mm256_add_epi32(r, _mm256_set1_epi32(128)), 8);
+        } else {
+            r = _mm256_srai_epi32(_mm256_add_epi32(inner, _mm256_set1_epi32(2)), 2);
+        }
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm256_castsi256_si128(packed));
+    }
+    return x;
+}
+
+inline bool hasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+inline void verticalRow(const uint16_t* a, const uint16_t* b, const uint16_t* c, const uint16_t* d,
+                        int32_t* out, int count, MipFilter filter) {
+    int done = 0;
+#ifdef MIPMAP_X86
+    done = hasAvx2() ? verticalAvx2(a, b, c, d, out, count, filter) : verticalSse2(a, b, c, d, out, count, filter);
+#endif
+    verticalScalar(a, b, c, d, out, done, count, filter);
+}
+
+inline void horizontalRow(const int32_t* v, int src_width, uint16_t* out, int out_width, MipFilter filter) {
+    // The first pixel and the last one or two need clamped taps
+    horizontalPixel(v, src_width, out, 0, filter);
+    int x = 1;
+#ifdef MIPMAP_X86
+    if (hasAvx2())
+        x = horizontalAvx2(v, src_width, out, x, out_width, filter);
+    x = horizontalSse2(v, src_width, out, x, out_width, filter);
+#endif
+    for (; x < out_width; ++x)
+        horizontalPixel(v, src_width, out, x, filter);
+}
+
+} // namespace mip_detail
+
+// Writes rows [y0, y1) of the level below `src`, half its size rounded
+// down and at least 1. Bands of rows can be given to different threads.
+inline void reduceLevel(const uint8_t* src, int src_width, int src_height, uint8_t* dst,
+                        MipFilter filter, int y0, int y1) {
+    using namespace mip_detail;
+    int width = std::max(1, src_width / 2);
+    // Scratch rows stay with the thread, so building a chain allocates once
+    static thread_local std::vector<uint16_t> rows, row_out;
+    static thread_local std::vector<int32_t> folded;
+    rows.resize(size_t(src_width) * 4 * 4);
+    folded.resize(size_t(src_width) * 4);
+    row_out.resize(size_t(width) * 4);
+    int tags[4] = {-1, -1, -1, -1}; // Source row decoded into each slot of `rows`
+
+    auto row = [&](int y) -> const uint16_t* {
+        y = std::min(std::max(y, 0), src_height - 1);
+        uint16_t* slot = &rows[size_t(y & 3) * src_width * 4];
+        if (tags[y & 3] != y) {
+            decodeRow(src + size_t(y) * src_width * 4, slot, src_width);
+            tags[y & 3] = y;
+        }
+        return slot;
+    };
+
+    for (int y = y0; y < y1; ++y) {
+        // Fetched in this order the four rows never evict one another
+        const uint16_t* a = row(2 * y - 1);
+        const uint16_t* b = row(2 * y);
+        const uint16_t* c = row(2 * y + 1);
+        const uint16_t* d = filter == MIP_SHARP ? row(2 * y + 2) : c;
+        verticalRow(a, b, c, d, folded.data(), src_width * 4, filter);
+        horizontalRow(folded.data(), src_width, row_out.data(), width, filter);
+        encodeRow(row_out.data(), dst + size_t(y) * width * 4, width);
+    }
+}
+
+// Builds every level below `base` into `chain`, which holds mipChainBytes()
+inline void buildMipChain(const uint8_t* base, int width, int height, uint8_t* chain, MipFilter filter) {
+    const uint8_t* src = base;
+    while (width > 1 || height > 1) {
+        int w = std::max(1, width / 2), h = std::max(1, height / 2);
+        reduceLevel(src, width, height, chain, filter, 0, h);
+        src = chain;
+        chain += size_t(w) * h * 4;
+        width = w;
+        height = h;
+    }
+}
+
+#endif // MIPMAP_H
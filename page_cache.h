@@ -0,0 +1,189 @@
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "page_file.h"
+
+// A decoded page mapped from the disk cache: BGRA level 0 followed by its
+// mip chain, laid out as the loader builds them in a PixelBuffer
+struct CachedPage {
+    PageFile* file = nullptr; // Owns the mapping
+    const unsigned char* pixels = nullptr;
+    int width = 0, height = 0, levels = 1;
+
+    explicit operator bool() const { return file != nullptr; }
+};
+
+// Decoded, downsized and mip-mapped pages kept between runs, one file per
+// page in cacheDirectory()/pages, shared by the SDL and the Qt viewer. A file is named after the page's path,
+// size and modification time, the largest size it was decoded for and the
+// mip filter, so an edited page or another setting simply misses. The
+// pixels start on a 64-byte boundary after the header and are uploaded
+// straight from the mapping. Hits refresh the file's modification time;
+// once the files pass max_bytes the least recently used go. Any thread.
+class PageCache {
+public:
+    explicit PageCache(size_t max_bytes = size_t(2) << 30) : max_total(max_bytes) {}
+
+    bool contains(const std::string& path, int target, int filter) {
+        struct stat st;
+        return stat(entryPath(path, target, filter).c_str(), &st) == 0;
+    }
+
+    // The cached page, or an empty CachedPage on a miss. The mapping is
+    // faulted in here so uploading from it doesn't wait for the disk.
+    CachedPage find(const std::string& path, int target, int filter) {
+        std::string entry = entryPath(path, target, filter);
+        PageFile* file = new PageFile(entry);
+        Header header;
+        if (!file->valid() || file->size < sizeof(header)) {
+            delete file;
+            return CachedPage();
+        }
+        std::memcpy(&header, file->data, sizeof(header));
+        if (std::memcmp(header.magic, "BOOKPAG1", 8) != 0 || header.width == 0 || header.height == 0 ||
+            file->size != sizeof(header) + levelBytes(header.width, header.height, header.levels)) {
+            delete file;
+            return CachedPage();
+        }
+        volatile unsigned char sink = 0;
+        for (size_t i = sizeof(header); i < file->size; i += 4096)
+            sink = sink + file->data[i];
+        utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+        CachedPage page;
+        page.file = file;
+        page.pixels = file->data + sizeof(header);
+        page.width = header.width;
+        page.height = header.height;
+        page.levels = header.levels;
+        return page;
+    }
+
+    // Writes a decoded page and its first `levels` levels, the ones below
+    // level 0 packed at `chain` (by default right behind the pixels).
+    // Written aside under a name of this thread and renamed, so a reader
+    // never maps half a file and two writers of one page don't mix.
+    void store(const std::string& path, int target, int filter, const unsigned char* pixels,
+               int width, int height, int levels, const unsigned char* chain = nullptr) {
+        std::string entry = entryPath(path, target, filter);
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(entry).parent_path(), error);
+        Header header = {{'B', 'O', 'O', 'K', 'P', 'A', 'G', '1'}, uint32_t(width), uint32_t(height), uint32_t(levels), {}};
+        size_t base = size_t(width) * height * 4;
+        size_t bytes = levelBytes(width, height, levels);
+        if (!chain)
+            chain = pixels + base;
+        std::string temporary = entry + "." + std::to_string(getpid()) + "." +
+                                std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(pixels), base);
+            out.write(reinterpret_cast<const char*>(chain), bytes - base);
+            if (!out) {
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, entry, error);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (total == unknown)
+            total = scan(nullptr);
+        total += sizeof(header) + bytes;
+        if (total > max_total)
+            evict();
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t width, height, levels;
+        char padding[44]; // Keeps the pixels 64-byte aligned in the mapping
+    };
+    static_assert(sizeof(Header) == 64, "cache header must stay 64 bytes");
+
+    static const size_t unknown = ~size_t(0);
+
+    static size_t levelBytes(int width, int height, int levels) {
+        size_t bytes = 0;
+        for (int level = 0; level < levels; ++level) {
+            bytes += size_t(width) * height * 4;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return bytes;
+    }
+
+    static std::filesystem::path directory() {
+        return cacheDirectory() / "pages";
+    }
+
+    static std::string entryPath(const std::string& path, int target, int filter) {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        auto mix = [&](const void* data, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ull;
+        };
+        struct stat st = {};
+        stat(path.c_str(), &st);
+        int64_t size = st.st_size, mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+        mix(path.data(), path.size());
+        mix(&size, sizeof(size));
+        mix(&mtime, sizeof(mtime));
+        mix(&target, sizeof(target));
+        mix(&filter, sizeof(filter));
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.page", (unsigned long long)hash);
+        return (directory() / name).string();
+    }
+
+    // Bytes in the cache, and its files when `entries` is given
+    size_t scan(std::vector<std::filesystem::directory_entry>* entries) {
+        size_t bytes = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory(), error)) {
+            if (entry.path().extension() != ".page")
+                continue;
+            bytes += entry.file_size(error);
+            if (entries)
+                entries->push_back(entry);
+        }
+        return bytes;
+    }
+
+    // Deletes the least recently used files down to 3/4 of the cap, so the
+    // next few pages don't each trigger a scan
+    void evict() {
+        std::vector<std::filesystem::directory_entry> entries;
+        total = scan(&entries);
+        std::error_code error;
+        std::sort(entries.begin(), entries.end(), [&](const auto& a, const auto& b) {
+            return a.last_write_time(error) < b.last_write_time(error);
+        });
+        for (const auto& entry : entries) {
+            if (total <= max_total / 4 * 3)
+                break;
+            size_t bytes = entry.file_size(error);
+            if (std::filesystem::remove(entry.path(), error))
+                total -= std::min(total, bytes);
+        }
+    }
+
+    const size_t max_total;
+    std::mutex mutex;
+    size_t total = unknown; // Scanned on the first store
+};
+
+#endif // PAGE_CACHE_H
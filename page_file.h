@@ -0,0 +1,78 @@
+#ifndef PAGE_FILE_H
+#define PAGE_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Whole-file view of a page image. The file is memory-mapped when possible
+// and read with a single bulk read() otherwise (some FUSE/NAS mounts refuse
+// mmap), so the decoder never goes through small stdio reads.
+class PageFile {
+public:
+    explicit PageFile(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = st.st_size;
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                mapping = mapped;
+                data = static_cast<unsigned char*>(mapped);
+                // Ask the kernel to fault the whole file in with large reads
+                madvise(mapping, size, MADV_SEQUENTIAL);
+                madvise(mapping, size, MADV_WILLNEED);
+            } else {
+                buffer.resize(size);
+                size_t done = 0;
+                while (done < size) {
+                    ssize_t n = read(fd, buffer.data() + done, size - done);
+                    if (n <= 0)
+                        break;
+                    done += n;
+                }
+                buffer.resize(done);
+                size = done;
+                data = buffer.data();
+            }
+        }
+        close(fd);
+    }
+
+    ~PageFile() {
+        if (mapping)
+            munmap(mapping, size);
+    }
+
+    PageFile(const PageFile&) = delete;
+    PageFile& operator=(const PageFile&) = delete;
+
+    bool valid() const { return data != nullptr && size > 0; }
+
+    unsigned char* data = nullptr;
+    size_t size = 0;
+
+private:
+    void* mapping = nullptr;
+    std::vector<unsigned char> buffer;
+};
+
+// Where decoded data is kept between runs: $XDG_CACHE_HOME/manga_real_3d,
+// ~/.cache/manga_real_3d by default
+inline std::filesystem::path cacheDirectory() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    std::filesystem::path dir = xdg && *xdg ? std::filesystem::path(xdg)
+                              : std::filesystem::path(home ? home : "/tmp") / ".cache";
+    return dir / "manga_real_3d";
+}
+
+#endif // PAGE_FILE_H
@@ -0,0 +1,74 @@
+#ifndef PAGE_INFO_H
+#define PAGE_INFO_H
+
+#include <FreeImage.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What the image header says about a page, known before any page is
+// decoded. 12 bytes per page, so a whole volume's table stays tiny.
+struct PageInfo {
+    uint32_t width = 0, height = 0; // As displayed, EXIF rotation applied
+    uint8_t bpp = 0;
+    uint8_t color = 0;       // FREE_IMAGE_COLOR_TYPE
+    uint8_t orientation = 1; // EXIF orientation of JPEGs, 1 when upright
+
+    bool known() const { return width > 0 && height > 0; }
+    // Orientations 2-8 need JPEG_EXIFROTATE, which the row decoders can't do
+    bool rotated() const { return orientation > 1; }
+    float aspect() const { return known() ? float(width) / height : 0.0f; }
+};
+
+// Reads only the header of one page. FIF_LOAD_NOPIXELS makes FreeImage
+// stop before the image data and stream just the first few kilobytes.
+inline PageInfo probePage(const std::string& filename) {
+    PageInfo info;
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(filename.c_str(), 0);
+    if (fif == FIF_UNKNOWN)
+        fif = FreeImage_GetFIFFromFilename(filename.c_str());
+    if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsNoPixels(fif))
+        return info;
+    FIBITMAP* dib = FreeImage_Load(fif, filename.c_str(), FIF_LOAD_NOPIXELS);
+    if (!dib)
+        return info;
+
+    info.width = FreeImage_GetWidth(dib);
+    info.height = FreeImage_GetHeight(dib);
+    info.bpp = FreeImage_GetBPP(dib);
+    info.color = FreeImage_GetColorType(dib);
+    FITAG* tag = nullptr;
+    if (fif == FIF_JPEG && FreeImage_GetMetadata(FIMD_EXIF_MAIN, dib, "Orientation", &tag) && tag &&
+        FreeImage_GetTagType(tag) == FIDT_SHORT) {
+        WORD orientation = *static_cast<const WORD*>(FreeImage_GetTagValue(tag));
+        if (orientation >= 1 && orientation <= 8)
+            info.orientation = orientation;
+    }
+    if (info.orientation >= 5) // Rotated by 90 degrees one way or the other
+        std::swap(info.width, info.height);
+    FreeImage_Unload(dib);
+    return info;
+}
+
+// Probes every page of a volume, spread over the available cores
+inline std::vector<PageInfo> probePages(const std::vector<std::string>& files) {
+    std::vector<PageInfo> table(files.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next++; i < files.size(); i = next++)
+            table[i] = probePage(files[i]);
+    };
+    unsigned count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), files.size());
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < count; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+    return table;
+}
+
+#endif // PAGE_INFO_H
@@ -0,0 +1,53 @@
+#ifndef PAGE_IO_H
+#define PAGE_IO_H
+
+#include <FreeImage.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "page_file.h"
+
+// Decodes a page from memory instead of letting FreeImage stream the file.
+// A non-zero `jpeg_reduce_size` lets libjpeg decode JPEGs at a reduced DCT
+// scale that is still at least that many pixels on the longest side.
+inline FIBITMAP* loadBitmap(const std::string& filename, int flags = 0, int jpeg_reduce_size = 0) {
+    PageFile file(filename);
+    if (!file.valid())
+        return nullptr;
+
+    FIMEMORY* memory = FreeImage_OpenMemory(file.data, file.size);
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeFromMemory(memory, 0);
+    if (fif == FIF_UNKNOWN)
+        fif = FreeImage_GetFIFFromFilename(filename.c_str());
+    if (fif == FIF_JPEG && jpeg_reduce_size > 0)
+        flags |= jpeg_reduce_size << 16;
+    FIBITMAP* dib = (fif != FIF_UNKNOWN) ? FreeImage_LoadFromMemory(fif, memory, flags) : nullptr;
+    FreeImage_CloseMemory(memory);
+    return dib;
+}
+
+// Starts asynchronous kernel readahead of a file. POSIX_FADV_WILLNEED only
+// queues the reads and returns, so the disk works while we decode.
+inline void prefetchFile(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+// Warms the page cache for the spreads around `page`. `step` is the index
+// delta of one spread in reading order (+2 for rtl, -2 for ltr).
+inline void prefetchPages(const std::vector<std::string>& files, int page, int step, int spreads_ahead = 2) {
+    auto prefetchSpread = [&](int first) {
+        for (int i = first; i < first + 2; ++i)
+            if (i >= 0 && i < (int)files.size())
+                prefetchFile(files[i]);
+    };
+    for (int s = 1; s <= spreads_ahead; ++s)
+        prefetchSpread(page + step * s);
+    prefetchSpread(page - step); // one spread back, for quick return
+}
+
+#endif // PAGE_IO_H
@@ -0,0 +1,105 @@
+#ifndef PIXEL_POOL_H
+#define PIXEL_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// 32-bit page pixels, bottom-up BGRA rows of width * 4 bytes, as
+// glTexImage2D takes them. The memory belongs to a PixelPool.
+struct PixelBuffer {
+    unsigned char* data = nullptr;
+    int width = 0, height = 0;
+    size_t capacity = 0;
+    int levels = 1; // Mip levels packed one after another from data
+
+    explicit operator bool() const { return data != nullptr; }
+};
+
+// Reusable page buffers in size classes an eighth of a power of two apart,
+// so pages of a volume (mostly one size) keep landing in the same class.
+// Buffers come back when their texture has been uploaded; once a reading
+// session has warmed the pool, turning pages allocates nothing. Any thread.
+class PixelPool {
+public:
+    struct Stats {
+        size_t allocations = 0; // Buffers taken from the heap
+        size_t reuses = 0;      // Buffers handed out again from a free list
+        size_t trims = 0;       // Buffers given back to the heap over max_idle
+        size_t bytes_in_use = 0;
+        size_t bytes_idle = 0;
+        size_t peak_bytes = 0;  // Most ever held, in use and idle together
+    };
+
+    explicit PixelPool(size_t max_idle_bytes) : max_idle(max_idle_bytes) {}
+
+    ~PixelPool() {
+        for (auto& list : idle)
+            for (unsigned char* data : list.second)
+                std::free(data);
+    }
+
+    // extra_bytes is room after the pixels, e.g. for their mip chain
+    PixelBuffer acquire(int width, int height, size_t extra_bytes = 0) {
+        PixelBuffer buffer;
+        buffer.width = width;
+        buffer.height = height;
+        buffer.capacity = sizeClass(size_t(width) * height * 4 + extra_bytes);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = idle.find(buffer.capacity);
+        if (it != idle.end() && !it->second.empty()) {
+            buffer.data = it->second.back();
+            it->second.pop_back();
+            counters.reuses++;
+            counters.bytes_idle -= buffer.capacity;
+        } else {
+            buffer.data = static_cast<unsigned char*>(std::aligned_alloc(64, buffer.capacity));
+            if (!buffer.data)
+                return PixelBuffer();
+            counters.allocations++;
+        }
+        counters.bytes_in_use += buffer.capacity;
+        counters.peak_bytes = std::max(counters.peak_bytes, counters.bytes_in_use + counters.bytes_idle);
+        return buffer;
+    }
+
+    void release(PixelBuffer& buffer) {
+        if (!buffer.data)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.bytes_in_use -= buffer.capacity;
+        if (counters.bytes_idle + buffer.capacity > max_idle) {
+            std::free(buffer.data);
+            counters.trims++;
+        } else {
+            idle[buffer.capacity].push_back(buffer.data);
+            counters.bytes_idle += buffer.capacity;
+        }
+        buffer = PixelBuffer();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+private:
+    static size_t sizeClass(size_t bytes) {
+        size_t power = 4096;
+        while (power * 2 < bytes)
+            power *= 2;
+        size_t step = std::max<size_t>(power / 8, 4096);
+        return (bytes + step - 1) / step * step;
+    }
+
+    const size_t max_idle;
+    mutable std::mutex mutex;
+    std::map<size_t, std::vector<unsigned char*>> idle;
+    Stats counters;
+};
+
+#endif // PIXEL_POOL_H
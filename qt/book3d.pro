@@ -1,9 +1,12 @@
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 CONFIG += c++17
 
+# Headers shared with the SDL viewer
+INCLUDEPATH += ..
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
@@ -13,8 +16,14 @@ SOURCES += \
     mainwindow.cpp
 
 HEADERS += \
+    ../mipmap.h \
+    ../page_cache.h \
+    ../page_file.h \
     bookwidget.h \
-    mainwindow.h
+    mainwindow.h \
+    overviewwidget.h \
+    pageinfo.h \
+    texturepool.h
 
 FORMS += \
     mainwindow.ui
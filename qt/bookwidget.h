@@ -7,10 +7,15 @@
 #include <QOpenGLTexture>
 #include <iostream>
 #include <QDir>
+#include <QFileSystemWatcher>
 #include <QImageReader> // Add this include
 #include <QPainter>
 #include <QRandomGenerator>
+#include <QSet>
+#include <QTimer>
 #include <utility>
+#include "pageinfo.h"
+#include "texturepool.h"
 
 class BookWidget : public QOpenGLWidget, protected QOpenGLFunctions_1_0
 {
@@ -23,12 +28,21 @@ public:
         for (int i = 0; i < control_tex_len; ++i) {
             textures[i] = nullptr;
         }
+        // Pages copied in together arrive as one reload
+        reloadTimer.setSingleShot(true);
+        reloadTimer.setInterval(300);
+        connect(&reloadTimer, &QTimer::timeout, this, &BookWidget::reloadBook);
+        connect(&watcher, &QFileSystemWatcher::directoryChanged, this, [this]{ reloadTimer.start(); });
+        connect(&watcher, &QFileSystemWatcher::fileChanged, this, [this](const QString& path){
+            changedFiles.insert(path);
+            reloadTimer.start();
+        });
     }
 
     ~BookWidget() {
         makeCurrent(); // Ensure OpenGL context is current
         for (int i = 0; i < control_tex_len; ++i) {
-            delete textures[i];
+            setTexture(i, nullptr);
         }
         doneCurrent();
     }
@@ -37,7 +51,6 @@ public:
     {
         right_to_left=false;
 
-        QStringList imagePaths;
         QDir directory(directoryPath);
 
         if (!directory.exists()) {
@@ -45,26 +58,16 @@ public:
             return;
         }
 
-        // Get all supported image extensions from Qt
-        QStringList imageExtensions;
-        const QList<QByteArray> formats = QImageReader::supportedImageFormats();
-        for (const QByteArray &format : formats) {
-            imageExtensions << "*." + QString::fromLatin1(format).toLower();
-        }
+        bookDir = directory.absolutePath();
+        pages = imageFiles(bookDir);
+        if(isWatching())
+            setWatching(true);
 
-        // Get all image files (case-insensitive match)
-        QFileInfoList files = directory.entryInfoList(
-            imageExtensions,
-            QDir::Files | QDir::Readable,
-            QDir::Name | QDir::IgnoreCase
-            );
-
-        // Collect paths
-        for (const QFileInfo &file : files) {
-            imagePaths.append(file.absoluteFilePath());
-        }
-
-        pages = imagePaths;
+        // Headers only, so page quads get their real shape before any decode
+        pageInfo.clear();
+        QVector<PageInfo> probed = probePages(pages);
+        for (int i = 0; i < pages.size(); ++i)
+            pageInfo.insert(pages[i], probed[i]);
         /*for(int i=0; i<imagePaths.size()-1; i++){
             pages.append(QImage(imagePaths[i]));
         }
@@ -77,7 +80,12 @@ public:
 
         bookSize = pages.size()-spec_tex_len-2;
 
-        loadTextures();
+        // A view that hasn't been shown yet loads them in initializeGL()
+        if(isValid()){
+            makeCurrent();
+            loadTextures();
+            doneCurrent();
+        }
 
         setPage(0);
     }
@@ -90,17 +98,12 @@ public:
         else
             currentPage = book_pages.size()-page-2;
 
-        if(currentPage+1 < book_pages.size()){
-            delete textures[control_tex_len-2];
-            textures[control_tex_len-2] = new QOpenGLTexture(QImage(book_pages.at(currentPage+1)));
-            delete textures[control_tex_len-3];
-            textures[control_tex_len-3] = new QOpenGLTexture(QImage(book_pages.at(currentPage)));
-
-            textures[control_tex_len-3]->setMagnificationFilter(QOpenGLTexture::Linear);
-            textures[control_tex_len-3]->setMinificationFilter(QOpenGLTexture::Linear);
-            textures[control_tex_len-2]->setMagnificationFilter(QOpenGLTexture::Linear);
-            textures[control_tex_len-2]->setMinificationFilter(QOpenGLTexture::Linear);
+        if(isValid()){
+            makeCurrent();
+            loadPageTextures();
+            doneCurrent();
         }
+        fillPageCache();
 
         update();
     }
@@ -109,6 +112,25 @@ public:
         return bookSize;
     }
 
+    // Book pages in file name order, i.e. reading order
+    QStringList pageFiles() const {
+        QStringList book_pages = pages.mid(spec_tex_len);
+        if(right_to_left)
+            std::reverse(book_pages.begin(), book_pages.end());
+        return book_pages;
+    }
+
+    bool isRightToLeft() const {
+        return right_to_left;
+    }
+
+    // setPage() argument of the spread showing pageFiles()[index]
+    int pageOfFile(int index) const {
+        // Spreads start on even pages, counted from the other end for rtl
+        int page = right_to_left ? index - 1 + ((index - 1) & 1) : index & ~1;
+        return qBound(0, page, bookSize);
+    }
+
     void set_right_to_left(){
         right_to_left = !right_to_left;
         QStringList mid = pages.mid(spec_tex_len);
@@ -119,6 +141,26 @@ public:
         setPage(0);
     }
 
+    // Watch mode: follows pages being added, rewritten or removed in the
+    // book directory without starting over, see reloadBook()
+    void setWatching(bool on){
+        if(!watcher.directories().isEmpty())
+            watcher.removePaths(watcher.directories());
+        if(!watcher.files().isEmpty())
+            watcher.removePaths(watcher.files());
+        changedFiles.clear();
+        if(on && !bookDir.isEmpty()){
+            watcher.addPath(bookDir);
+            if(!pages.isEmpty())
+                watcher.addPaths(pages);
+        }
+        watching = on;
+    }
+
+    bool isWatching() const {
+        return watching;
+    }
+
     void set_soft_cover_z(float z){
         soft_cover_z = z;
         update();
@@ -135,28 +177,66 @@ public:
     }
 
 
+signals:
+    // The page list changed under watch mode
+    void pagesChanged();
+
 protected:
+    // Textures come from the process-wide TexturePool, so views showing the
+    // same files share them. Needs the GL context current.
+    void setTexture(int i, QOpenGLTexture* texture){
+        TexturePool::instance().release(textures[i]);
+        textures[i] = texture;
+    }
+
+    // Pooled texture of an image file, or a solid colour if it fails to load
+    QOpenGLTexture* acquireImage(const QString& path, int i){
+        QOpenGLTexture* texture = path.isEmpty() ? nullptr : TexturePool::instance().acquire(path);
+        if(texture)
+            return texture;
+        return TexturePool::instance().acquire("fallback:" + QString::number(i), [i]{
+            QImage img(64, 64, QImage::Format_RGBA8888);
+            img.fill(i == 0 ? Qt::red : i == 1 ? QColorConstants::Svg::orange : i == 2 ? Qt::yellow :
+                                        i == 3 ? Qt::green : i == 4 ? Qt::cyan : i==5 ? Qt::blue : QColorConstants::Svg::violet);
+            return img;
+        });
+    }
+
     void loadTextures(){
         for (int i = 0; i < control_tex_len-1; ++i) {
-            QImage img;
+            QString path;
             if(!(pages.size()<control_tex_len))
-                img = QImage(pages[i]);
-            if (img.isNull()) {
-                // Fallback to a solid color if texture fails to load
-                img = QImage(64, 64, QImage::Format_RGBA8888);
-                img.fill(i == 0 ? Qt::red : i == 1 ? QColorConstants::Svg::orange : i == 2 ? Qt::yellow :
-                                            i == 3 ? Qt::green : i == 4 ? Qt::cyan : i==5 ? Qt::blue : QColorConstants::Svg::violet);
-            }
+                path = pages[i];
+            setTexture(i, acquireImage(path, i));
+        }
+        // The stack lines are random, every view draws its own
+        setTexture(control_tex_len-1, TexturePool::instance().acquire(
+            QString("stack:%1").arg(quintptr(this)), [this]{ return draw_stack_texture(); }));
+    }
 
-            QOpenGLTexture* texture = new QOpenGLTexture(img);
-            //texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-            texture->setMagnificationFilter(QOpenGLTexture::Linear);
-            texture->setMinificationFilter(QOpenGLTexture::Linear);
-            delete textures[i];
-            textures[i] = texture;
+    void loadPageTextures(){
+        QStringList book_pages = pages.mid(spec_tex_len);
+        if(currentPage >= 0 && currentPage+1 < book_pages.size()){
+            setTexture(control_tex_len-2, acquireImage(book_pages.at(currentPage+1), control_tex_len-2));
+            setTexture(control_tex_len-3, acquireImage(book_pages.at(currentPage), control_tex_len-3));
+        }
+        else if(!textures[control_tex_len-2]){
+            setTexture(control_tex_len-2, acquireImage(QString(), control_tex_len-2));
+            setTexture(control_tex_len-3, acquireImage(QString(), control_tex_len-3));
+        }
+    }
+
+    // The next spreads in reading order go into the PageCache while this
+    // one is read, so turning to them only maps and uploads
+    void fillPageCache(){
+        QStringList book_pages = pages.mid(spec_tex_len);
+        int step = right_to_left ? -2 : 2;
+        for(int spread = 1; spread <= 3; ++spread){
+            for(int i = currentPage + step * spread; i < currentPage + step * spread + 2; ++i){
+                if(i >= 0 && i < book_pages.size())
+                    TexturePool::instance().prefetch(book_pages.at(i));
+            }
         }
-        delete textures[control_tex_len-1];
-        textures[control_tex_len-1] = new QOpenGLTexture(draw_stack_texture());
     }
 
     void initializeGL() override {
@@ -165,6 +245,7 @@ protected:
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_TEXTURE_2D); // Enable 2D texturing
         loadTextures();
+        loadPageTextures();
     }
 
     void resizeGL(int w, int h) override {
@@ -216,6 +297,7 @@ protected:
 private:
     //QList<QImage> pages;
     QStringList pages;
+    QHash<QString, PageInfo> pageInfo; // Keyed by path, so it survives set_right_to_left
     float rotX, rotY, zoom;
     QPoint startPos;
     static const int control_tex_len = 11;
@@ -230,6 +312,85 @@ private:
 
     bool right_to_left = false;
 
+    QString bookDir;
+    QFileSystemWatcher watcher;
+    QSet<QString> changedFiles; // Rewritten since the last reloadBook()
+    QTimer reloadTimer;
+    bool watching = false;
+
+    // Image files Qt can read, by case-insensitive name
+    static QStringList imageFiles(const QString& directoryPath){
+        // Get all supported image extensions from Qt
+        QStringList imageExtensions;
+        const QList<QByteArray> formats = QImageReader::supportedImageFormats();
+        for (const QByteArray &format : formats) {
+            imageExtensions << "*." + QString::fromLatin1(format).toLower();
+        }
+
+        // Get all image files (case-insensitive match)
+        QFileInfoList files = QDir(directoryPath).entryInfoList(
+            imageExtensions,
+            QDir::Files | QDir::Readable,
+            QDir::Name | QDir::IgnoreCase
+            );
+
+        QStringList imagePaths;
+        for (const QFileInfo &file : files) {
+            imagePaths.append(file.absoluteFilePath());
+        }
+        return imagePaths;
+    }
+
+    // Re-reads the book directory in watch mode. Only added and rewritten
+    // files are probed and decoded again, everything else comes out of the
+    // TexturePool, and the book stays on the page it showed.
+    void reloadBook(){
+        QStringList files = imageFiles(bookDir);
+        if(files.isEmpty())
+            return;
+        for(const QString& path : qAsConst(changedFiles)){
+            TexturePool::instance().invalidate(path);
+            pageInfo.remove(path);
+        }
+        changedFiles.clear();
+
+        // The order set_right_to_left leaves the pages in
+        if(right_to_left){
+            QStringList mid = files.mid(spec_tex_len);
+            files = files.mid(0, spec_tex_len) + QStringList(mid.rbegin(), mid.rend());
+        }
+        QStringList book_pages = pages.mid(spec_tex_len);
+        QString shown = currentPage >= 0 && currentPage < book_pages.size() ? book_pages.at(currentPage) : QString();
+
+        QStringList added;
+        for(const QString& path : qAsConst(files))
+            if(!pageInfo.contains(path))
+                added.append(path);
+        QVector<PageInfo> probed = probePages(added);
+        for(int i = 0; i < added.size(); ++i)
+            pageInfo.insert(added[i], probed[i]);
+        QSet<QString> present;
+        for(const QString& path : qAsConst(files))
+            present.insert(path);
+        for(auto it = pageInfo.begin(); it != pageInfo.end();)
+            it = present.contains(it.key()) ? it + 1 : pageInfo.erase(it);
+
+        pages = files;
+        bookSize = pages.size()-spec_tex_len-2;
+        int index = pages.mid(spec_tex_len).indexOf(shown);
+        currentPage = index >= 0 ? index : qBound(0, currentPage, qMax(0, bookSize));
+
+        if(isValid()){
+            makeCurrent();
+            loadTextures();
+            loadPageTextures();
+            doneCurrent();
+        }
+        setWatching(true); // Files replaced by a rename drop out of the watch
+        update();
+        emit pagesChanged();
+    }
+
     QImage draw_stack_texture(){
         const int width = 1024;   // Ширина изображения
         const int height = 1024;  // Высота изображения
@@ -251,6 +412,21 @@ private:
         return image.transformed(QMatrix().rotate(90.0));
     }
 
+    // Half size of a page quad: the page's own aspect letterboxed into the
+    // 1x2 half of the spread that glScalef(4,3,4) stretches to 4x6
+    QSizeF pageExtent(int page){
+        const float slot_aspect = 4.0f / 6.0f;
+        QStringList book_pages = pages.mid(spec_tex_len);
+        if(page < 0 || page >= book_pages.size())
+            return QSizeF(1, 1);
+        PageInfo info = pageInfo.value(book_pages.at(page));
+        if(!info.known())
+            return QSizeF(1, 1);
+        if(info.aspect() > slot_aspect)
+            return QSizeF(1, slot_aspect / info.aspect());
+        return QSizeF(info.aspect() / slot_aspect, 1);
+    }
+
     void DrawBook(){
         ///Spine
         GLfloat spine_size = bookSize*paper_depth;
@@ -451,21 +627,25 @@ private:
         glEnd();
 
         ///Pages
+        QSizeF right_extent = pageExtent(currentPage+1);
+        QSizeF left_extent = pageExtent(currentPage);
+        GLfloat right_w = right_page*right_extent.width(), right_h = right_extent.height();
+        GLfloat left_w = left_page*left_extent.width(), left_h = left_extent.height();
         //right page
         textures[control_tex_len-2]->bind();
         glBegin(GL_QUADS);
-            glTexCoord2f(0.0f, 0.0f); glVertex3f(0, 1.0f, spine_radius+paper_depth);
-            glTexCoord2f(1.0f, 0.0f); glVertex3f(right_page, 1.0f, spine_radius+paper_depth);
-            glTexCoord2f(1.0f, 1.0f); glVertex3f(right_page, -1.0f, spine_radius+paper_depth);
-            glTexCoord2f(0.0f, 1.0f); glVertex3f(0, -1.0f, spine_radius+paper_depth);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(0, right_h, spine_radius+paper_depth);
+            glTexCoord2f(1.0f, 0.0f); glVertex3f(right_w, right_h, spine_radius+paper_depth);
+            glTexCoord2f(1.0f, 1.0f); glVertex3f(right_w, -right_h, spine_radius+paper_depth);
+            glTexCoord2f(0.0f, 1.0f); glVertex3f(0, -right_h, spine_radius+paper_depth);
         glEnd();
         //left page
         textures[control_tex_len-3]->bind();
         glBegin(GL_QUADS);
-            glTexCoord2f(1.0f, 0.0f); glVertex3f(0, 1.0f, spine_radius+paper_depth);
-            glTexCoord2f(0.0f, 0.0f); glVertex3f(left_page, 1.0f, spine_radius+paper_depth);
-            glTexCoord2f(0.0f, 1.0f); glVertex3f(left_page, -1.0f, spine_radius+paper_depth);
-            glTexCoord2f(1.0f, 1.0f); glVertex3f(0, -1.0f, spine_radius+paper_depth);
+            glTexCoord2f(1.0f, 0.0f); glVertex3f(0, left_h, spine_radius+paper_depth);
+            glTexCoord2f(0.0f, 0.0f); glVertex3f(left_w, left_h, spine_radius+paper_depth);
+            glTexCoord2f(0.0f, 1.0f); glVertex3f(left_w, -left_h, spine_radius+paper_depth);
+            glTexCoord2f(1.0f, 1.0f); glVertex3f(0, -left_h, spine_radius+paper_depth);
         glEnd();
     }
 };
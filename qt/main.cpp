@@ -4,6 +4,8 @@
 
 int main(int argc, char *argv[])
 {
+    // All book views share one GL share group, and with it the TexturePool
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
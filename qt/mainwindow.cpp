@@ -1,11 +1,14 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "overviewwidget.h"
+#include "texturepool.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    connect(ui->bookRender, &BookWidget::pagesChanged, this, &MainWindow::updatePageCount);
 }
 
 MainWindow::~MainWindow()
@@ -13,38 +16,110 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+QList<BookWidget*> MainWindow::views() const
+{
+    return QList<BookWidget*>{ui->bookRender} + extraViews;
+}
+
 void MainWindow::on_loadBook_clicked()
 {
     ui->bookRender->loadBook(ui->dirPath->text());
     ui->pageSpinBox->setMaximum(ui->bookRender->getPageCount());
 }
 
+// A comparison view of whatever is in dirPath. Pages it has in common with
+// the other views come out of the shared TexturePool without a reload.
+void MainWindow::on_addView_clicked()
+{
+    BookWidget* view = new BookWidget(this);
+    ui->viewsLayout->addWidget(view);
+    extraViews.append(view);
+    view->loadBook(ui->dirPath->text());
+    view->set_soft_cover_z(float(ui->horizontalSlider->value())/100);
+    view->set_hide_hyousiura(ui->checkBox->isChecked());
+    view->set_hide_soft_cover(ui->checkBox_2->isChecked());
+    view->setWatching(ui->watchDir->isChecked());
+    if(ui->lockstep->isChecked())
+        view->setPage(ui->pageSpinBox->value());
+}
+
+// Swaps the book views for a thumbnail grid of the first one's pages
+void MainWindow::on_overview_toggled(bool checked)
+{
+    if(checked && !overview){
+        overview = new OverviewWidget(this);
+        connect(overview, &OverviewWidget::pageClicked, this, &MainWindow::showClickedPage);
+        ui->viewsLayout->addWidget(overview);
+    }
+    if(checked)
+        overview->setPages(ui->bookRender->pageFiles(), ui->bookRender->isRightToLeft());
+    if(overview)
+        overview->setVisible(checked);
+    for(BookWidget* view : views())
+        view->setVisible(!checked);
+}
+
+// Applies to pages loaded after the switch
+void MainWindow::on_sharpMipmaps_toggled(bool checked)
+{
+    TexturePool::instance().setMipFilter(checked ? MIP_SHARP : MIP_SMOOTH);
+}
+
+// Watch mode: every view follows its book directory as pages come and go
+void MainWindow::on_watchDir_toggled(bool checked)
+{
+    for(BookWidget* view : views())
+        view->setWatching(checked);
+}
+
+void MainWindow::updatePageCount()
+{
+    ui->pageSpinBox->setMaximum(ui->bookRender->getPageCount());
+    if(overview && overview->isVisible())
+        overview->setPages(ui->bookRender->pageFiles(), ui->bookRender->isRightToLeft());
+}
+
+void MainWindow::showClickedPage(int index)
+{
+    ui->pageSpinBox->setValue(ui->bookRender->pageOfFile(index));
+    ui->overview->setChecked(false);
+}
+
 void MainWindow::on_pageSpinBox_valueChanged(int arg1)
 {
-    ui->bookRender->setPage(arg1);
+    if(!ui->lockstep->isChecked()){
+        ui->bookRender->setPage(arg1);
+        return;
+    }
+    for(BookWidget* view : views())
+        view->setPage(arg1);
 }
 
 
 void MainWindow::on_rightToLeft_clicked()
 {
-    ui->bookRender->set_right_to_left();
+    for(BookWidget* view : views())
+        view->set_right_to_left();
 }
 
 
 void MainWindow::on_horizontalSlider_sliderMoved(int position)
 {
-    ui->bookRender->set_soft_cover_z(float(position)/100);
+    for(BookWidget* view : views())
+        view->set_soft_cover_z(float(position)/100);
 }
 
 
 void MainWindow::on_checkBox_stateChanged(int arg1)
 {
-    ui->bookRender->set_hide_hyousiura(arg1);
+    for(BookWidget* view : views())
+        view->set_hide_hyousiura(arg1);
 }
 
 
 void MainWindow::on_checkBox_2_stateChanged(int arg1)
 {
-    ui->bookRender->set_hide_soft_cover(arg1);
+    for(BookWidget* view : views())
+        view->set_hide_soft_cover(arg1);
 }
 
@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QList>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -9,6 +10,9 @@ class MainWindow;
 }
 QT_END_NAMESPACE
 
+class BookWidget;
+class OverviewWidget;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -30,7 +34,23 @@ private slots:
 
     void on_checkBox_2_stateChanged(int arg1);
 
+    void on_addView_clicked();
+
+    void on_overview_toggled(bool checked);
+
+    void on_sharpMipmaps_toggled(bool checked);
+
+    void on_watchDir_toggled(bool checked);
+
+    void updatePageCount();
+
+    void showClickedPage(int index);
+
 private:
+    QList<BookWidget*> views() const;
+
     Ui::MainWindow *ui;
+    QList<BookWidget*> extraViews;
+    OverviewWidget* overview = nullptr; // Made the first time it is shown
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,323 @@
+#ifndef OVERVIEWWIDGET_H
+#define OVERVIEWWIDGET_H
+
+#include <QOpenGLWidget>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QImageReader>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QVector>
+#include <QVector2D>
+#include <QWheelEvent>
+#include <QtConcurrent/QtConcurrentMap>
+#include <cmath>
+
+// Every page of a book as a grid of thumbnails. The thumbnails are made on
+// the global thread pool, packed into the layers of one texture array and
+// drawn with a single instanced call; the packed atlas is cached on disk
+// so a book opened before shows up at once.
+class OverviewWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+public:
+    static const int cell = 128; // Thumbnail cell, the page is letterboxed inside
+    static const int side = 2048;
+    static const int cells_per_side = side / cell;
+    static const int cells_per_layer = cells_per_side * cells_per_side;
+
+    OverviewWidget(QWidget *parent = nullptr) : QOpenGLWidget(parent) {
+        QSurfaceFormat f = format();
+        f.setVersion(3, 3);
+        setFormat(f);
+        connect(&watcher, &QFutureWatcher<QImage>::resultReadyAt, this, [this](int i){
+            place(i, watcher.resultAt(i));
+        });
+        connect(&watcher, &QFutureWatcher<QImage>::finished, this, [this]{
+            if(watcher.isCanceled())
+                return;
+            writeCache();
+            complete = true;
+            update();
+        });
+    }
+
+    ~OverviewWidget() {
+        watcher.cancel();
+        watcher.waitForFinished();
+        makeCurrent();
+        if(texture)
+            glDeleteTextures(1, &texture);
+        program.reset();
+        vao.destroy();
+        doneCurrent();
+    }
+
+    // Pages in reading order; right_to_left lays the rows out right to left
+    void setPages(const QStringList& paths, bool right_to_left){
+        if(paths == pages && right_to_left == mirror)
+            return;
+        watcher.cancel();
+        watcher.waitForFinished();
+        pages = paths;
+        mirror = right_to_left;
+        scroll = 0;
+        layers = QVector<QImage>((pages.size() + cells_per_layer - 1) / cells_per_layer);
+        for(QImage& layer : layers){
+            layer = QImage(side, side, QImage::Format_RGBA8888);
+            layer.fill(Qt::transparent);
+        }
+        sources = sourcesHash();
+        cachePath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/" + sources.toHex() + ".atlas";
+        dirty = true;
+        complete = readCache();
+        if(!complete)
+            watcher.setFuture(QtConcurrent::mapped(pages, makeThumbnail));
+        update();
+    }
+
+signals:
+    void pageClicked(int index);
+
+protected:
+    void initializeGL() override {
+        initializeOpenGLFunctions();
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glGenTextures(1, &texture);
+        vao.create();
+        program.reset(new QOpenGLShaderProgram);
+        program->addShaderFromSourceCode(QOpenGLShader::Vertex, R"(
+            #version 330 core
+            out vec3 TexCoord;
+            uniform vec2 viewport;
+            uniform float cellSize;
+            uniform float scroll;
+            uniform int columns;
+            uniform int mirror;
+            uniform int cellsPerSide;
+            void main() {
+                vec2 corner01 = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+                int i = gl_InstanceID;
+                int column = i % columns;
+                if (mirror != 0)
+                    column = columns - 1 - column;
+                float margin = (viewport.x - float(columns) * cellSize) / 2.0;
+                vec2 corner = vec2(margin + float(column) * cellSize, float(i / columns) * cellSize - scroll);
+                vec2 p = corner + cellSize * (0.04 + 0.92 * corner01);
+                gl_Position = vec4(p.x / viewport.x * 2.0 - 1.0, 1.0 - p.y / viewport.y * 2.0, 0.0, 1.0);
+                int perLayer = cellsPerSide * cellsPerSide;
+                int c = i % perLayer;
+                TexCoord = vec3((vec2(c % cellsPerSide, c / cellsPerSide) + corner01) / float(cellsPerSide),
+                                float(i / perLayer));
+            }
+        )");
+        program->addShaderFromSourceCode(QOpenGLShader::Fragment, R"(
+            #version 330 core
+            in vec3 TexCoord;
+            out vec4 FragColor;
+            uniform sampler2DArray atlas;
+            void main() {
+                vec4 c = texture(atlas, TexCoord);
+                FragColor = vec4(mix(vec3(0.2), c.rgb, c.a), 1.0);
+            }
+        )");
+        program->link();
+    }
+
+    void paintGL() override {
+        glClear(GL_COLOR_BUFFER_BIT);
+        if(pages.isEmpty())
+            return;
+        upload();
+
+        program->bind();
+        program->setUniformValue("viewport", QVector2D(width(), height()));
+        program->setUniformValue("cellSize", cellSize);
+        program->setUniformValue("scroll", scroll);
+        program->setUniformValue("columns", columns());
+        program->setUniformValue("mirror", int(mirror));
+        program->setUniformValue("cellsPerSide", cells_per_side);
+        program->setUniformValue("atlas", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        vao.bind();
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, pages.size());
+        vao.release();
+        program->release();
+    }
+
+    void wheelEvent(QWheelEvent *event) override {
+        float steps = event->angleDelta().y() / 120.0f;
+        if(event->modifiers() & Qt::ControlModifier)
+            cellSize = qBound(64.0f, cellSize * std::pow(1.1f, steps), 512.0f);
+        else
+            scroll -= steps * cellSize / 2;
+        int rows = (pages.size() + columns() - 1) / columns();
+        scroll = qBound(0.0f, scroll, qMax(0.0f, rows * cellSize - height()));
+        update();
+        event->accept();
+    }
+
+    void mousePressEvent(QMouseEvent *event) override {
+        float margin = (width() - columns() * cellSize) / 2;
+        int column = int(std::floor((event->pos().x() - margin) / cellSize));
+        int row = int(std::floor((event->pos().y() + scroll) / cellSize));
+        if(column >= 0 && column < columns() && row >= 0){
+            if(mirror)
+                column = columns() - 1 - column;
+            int index = row * columns() + column;
+            if(index < pages.size())
+                emit pageClicked(index);
+        }
+        event->accept();
+    }
+
+private:
+    QStringList pages;
+    bool mirror = false;
+    float cellSize = 160;
+    float scroll = 0;
+    QVector<QImage> layers; // Thumbnails packed on the GUI thread
+    QVector<int> placed; // Cells waiting for upload
+    bool dirty = false; // Every layer needs uploading
+    bool complete = false; // Every thumbnail is placed
+    bool mipmapped = false; // The texture's levels below 0 match level 0
+    QByteArray sources; // SHA-1 of the page files, see sourcesHash()
+    QString cachePath;
+    QFutureWatcher<QImage> watcher;
+    GLuint texture = 0;
+    QScopedPointer<QOpenGLShaderProgram> program;
+    QOpenGLVertexArrayObject vao;
+
+    int columns() const {
+        return qMax(1, int(width() / cellSize));
+    }
+
+    // Runs on the thread pool. Readers that support it (JPEG) decode
+    // straight at the reduced size.
+    static QImage makeThumbnail(const QString& path){
+        QImageReader reader(path);
+        reader.setAutoTransform(true);
+        QSize size = reader.size();
+        // Left alone for rotated pages, whose stored size is transposed
+        if(size.isValid() && !(reader.transformation() & QImageIOHandler::TransformationRotate90))
+            reader.setScaledSize(size.scaled(cell, cell, Qt::KeepAspectRatio));
+        QImage img = reader.read();
+        if(img.isNull())
+            return img;
+        if(img.width() > cell || img.height() > cell)
+            img = img.scaled(cell, cell, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        return img.convertToFormat(QImage::Format_RGBA8888);
+    }
+
+    void place(int i, const QImage& thumbnail){
+        if(thumbnail.isNull())
+            return;
+        int c = i % cells_per_layer;
+        QPainter painter(&layers[i / cells_per_layer]);
+        painter.drawImage((c % cells_per_side) * cell + (cell - thumbnail.width()) / 2,
+                          (c / cells_per_side) * cell + (cell - thumbnail.height()) / 2, thumbnail);
+        placed.append(i);
+        update();
+    }
+
+    // Level 0 only while thumbnails are still coming in; the mip levels
+    // are made once they are all placed, so a zoomed-out grid doesn't
+    // shimmer
+    void upload(){
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        if(dirty || !placed.isEmpty()){
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            mipmapped = false;
+        }
+        if(dirty){
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, side, side, layers.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            for(int l = 0; l < layers.size(); ++l)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, side, side, 1, GL_RGBA, GL_UNSIGNED_BYTE, layers[l].constBits());
+            dirty = false;
+        } else if(!placed.isEmpty()){
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, side);
+            for(int i : placed){
+                int c = i % cells_per_layer;
+                int x = (c % cells_per_side) * cell, y = (c / cells_per_side) * cell;
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, i / cells_per_layer, cell, cell, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                                layers[i / cells_per_layer].constScanLine(y) + x * 4);
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
+        placed.clear();
+        if(complete && !mipmapped){
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            mipmapped = true;
+        }
+    }
+
+    struct CacheHeader {
+        char magic[8];
+        qint32 cell, side, pages, layers;
+        char sources[20]; // sourcesHash() of the pages it was made from
+        char padding[20];
+    };
+
+    // The page files with their sizes and modification times, so editing
+    // or replacing a page makes a new atlas. Also names the cache file.
+    QByteArray sourcesHash() const {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for(const QString& path : pages){
+            QFileInfo info(path);
+            hash.addData(path.toUtf8());
+            hash.addData(QByteArray::number(info.size()));
+            hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+        }
+        return hash.result();
+    }
+
+    bool readCache(){
+        QFile file(cachePath);
+        qint64 bytes = qint64(layers.size()) * side * side * 4;
+        CacheHeader header;
+        if(!file.open(QIODevice::ReadOnly) || file.size() != qint64(sizeof(header)) + bytes)
+            return false;
+        const uchar* data = file.map(0, file.size());
+        if(!data)
+            return false;
+        memcpy(&header, data, sizeof(header));
+        if(memcmp(header.magic, "BOOKQAT1", 8) != 0 || header.cell != cell || header.side != side ||
+           header.pages != pages.size() || header.layers != layers.size() ||
+           sources != QByteArray::fromRawData(header.sources, sizeof(header.sources)))
+            return false;
+        data += sizeof(header);
+        for(int l = 0; l < layers.size(); ++l)
+            memcpy(layers[l].bits(), data + qint64(l) * side * side * 4, side * side * 4);
+        return true;
+    }
+
+    void writeCache(){
+        QDir().mkpath(QFileInfo(cachePath).path());
+        QSaveFile file(cachePath);
+        if(!file.open(QIODevice::WriteOnly))
+            return;
+        CacheHeader header = {{'B', 'O', 'O', 'K', 'Q', 'A', 'T', '1'}, cell, side, qint32(pages.size()), qint32(layers.size()), {}, {}};
+        memcpy(header.sources, sources.constData(), qMin(sources.size(), int(sizeof(header.sources))));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for(const QImage& layer : layers)
+            file.write(reinterpret_cast<const char*>(layer.constBits()), layer.sizeInBytes());
+        file.commit();
+    }
+};
+
+#endif // OVERVIEWWIDGET_H
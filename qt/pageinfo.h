@@ -0,0 +1,44 @@
+#ifndef PAGEINFO_H
+#define PAGEINFO_H
+
+#include <QImage>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
+
+// What the image header says about a page, read without decoding it
+struct PageInfo
+{
+    QSize size; // As displayed, EXIF rotation applied
+    QImage::Format format = QImage::Format_Invalid; // Bit depth and colour type
+    QImageIOHandler::Transformations transformation = QImageIOHandler::TransformationNone;
+
+    bool known() const { return size.width() > 0 && size.height() > 0; }
+    float aspect() const { return known() ? float(size.width()) / size.height() : 0.0f; }
+};
+
+// QImageReader only parses the header for size(), imageFormat() and
+// transformation(); the pixels are never touched.
+inline PageInfo probePage(const QString& path)
+{
+    PageInfo info;
+    QImageReader reader(path);
+    info.size = reader.size();
+    info.format = reader.imageFormat();
+    info.transformation = reader.transformation();
+    if (info.transformation & QImageIOHandler::TransformationRotate90)
+        info.size.transpose();
+    return info;
+}
+
+// Probes every page on the global thread pool
+inline QVector<PageInfo> probePages(const QStringList& paths)
+{
+    return QtConcurrent::blockingMapped<QVector<PageInfo>>(paths, probePage);
+}
+
+#endif // PAGEINFO_H
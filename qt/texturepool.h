@@ -0,0 +1,301 @@
+#ifndef TEXTUREPOOL_H
+#define TEXTUREPOOL_H
+
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QImageReader>
+#include <QOpenGLPixelTransferOptions>
+#include <QOpenGLTexture>
+#include <QPainter>
+#include <QString>
+#include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <functional>
+#include "mipmap.h"
+#include "page_cache.h"
+
+// Process-wide, reference-counted page textures. With
+// Qt::AA_ShareOpenGLContexts every BookWidget lives in one share group, so
+// a page decoded and uploaded for one view is reused by all the others.
+// All calls need a GL context of that group current.
+class TexturePool
+{
+public:
+    struct Stats {
+        int shared = 0;    // acquire() answered with a texture already pooled
+        int cached = 0;    // ... uploaded from the disk PageCache
+        int decodes = 0;   // Image files read for a new texture
+        int reused = 0;    // ... of those, read into an existing scratch image
+        int converted = 0; // Uploads that needed a format conversion copy
+    };
+
+    // Mip filter for textures uploaded from now on; pooled ones keep theirs
+    void setMipFilter(MipFilter filter){
+        mipFilter = filter;
+    }
+
+    static TexturePool& instance(){
+        static TexturePool pool;
+        return pool;
+    }
+
+    // Texture of an image file, scaled down to fit maxSize (0 keeps the
+    // file's resolution). Returns nullptr when the file can't be read.
+    // A page decoded in an earlier run is uploaded straight from the
+    // PageCache mapping. Otherwise, pages of a book mostly share one size
+    // and format, so the reader decodes into the scratch image an earlier
+    // page left behind and nothing new is allocated per page.
+    QOpenGLTexture* acquire(const QString& path, int maxSize = 0){
+        QString key = path + '@' + QString::number(maxSize);
+        if(QOpenGLTexture* texture = share(key))
+            return texture;
+
+        std::string file = QFile::encodeName(path).toStdString();
+        CachedPage cached = pageCache.find(file, maxSize, mipFilter);
+        if(cached){
+            counters.cached++;
+            const uchar* chain = cached.pixels + size_t(cached.width) * cached.height * 4;
+            QOpenGLTexture* texture = upload(cached.width, cached.height, cached.pixels, chain);
+            delete cached.file;
+            return insert(key, texture);
+        }
+
+        QImageReader reader(path);
+        QImage& image = scratch(prepareReader(reader, maxSize), reader.imageFormat());
+        counters.decodes++;
+        if(!reader.read(&image))
+            return nullptr;
+        fit(image, maxSize);
+        const QImage& pixels = to32Bit(image);
+        QOpenGLTexture* texture = upload(pixels);
+        // The copies share their data with the scratch images, decoding the
+        // next page into those only detaches them
+        QtConcurrent::run([this, file, maxSize, filter = mipFilter, pixels = QImage(pixels), chain = mipChain]{
+            store(file, maxSize, filter, pixels, chain);
+        });
+        return insert(key, texture);
+    }
+
+    // Decodes a page the reader is heading to into the page cache on the
+    // global thread pool, so that acquire() only maps it later. Needs no
+    // GL context.
+    void prefetch(const QString& path, int maxSize = 0){
+        std::string file = QFile::encodeName(path).toStdString();
+        if(entries.contains(path + '@' + QString::number(maxSize)) || pageCache.contains(file, maxSize, mipFilter))
+            return;
+        QtConcurrent::run([this, path, file, maxSize, filter = mipFilter]{
+            QImageReader reader(path);
+            prepareReader(reader, maxSize);
+            QImage image;
+            if(!reader.read(&image))
+                return;
+            fit(image, maxSize);
+            if(!is32Bit(image))
+                image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+            QByteArray chain(int(mipChainBytes(image.width(), image.height())), Qt::Uninitialized);
+            ::buildMipChain(image.constBits(), image.width(), image.height(),
+                            reinterpret_cast<uint8_t*>(chain.data()), filter);
+            store(file, maxSize, filter, image, chain);
+        });
+    }
+
+    // Texture for any other image; `load` only runs when `key` isn't pooled yet
+    QOpenGLTexture* acquire(const QString& key, const std::function<QImage()>& load){
+        if(QOpenGLTexture* texture = share(key))
+            return texture;
+        QImage img = load();
+        if(img.isNull())
+            return nullptr;
+        return insert(key, upload(img));
+    }
+
+    void release(QOpenGLTexture* texture){
+        auto key = keys.find(texture);
+        if(key == keys.end())
+            return;
+        auto it = entries.find(*key);
+        if(--it->refs == 0){
+            delete it->texture;
+            entries.erase(it);
+            keys.erase(key);
+        }
+    }
+
+    // The file at `path` has changed: later acquire() calls decode it again,
+    // views still holding the old texture keep it until they release it
+    void invalidate(const QString& path){
+        const QStringList stale = entries.keys();
+        for(const QString& key : stale){
+            if(!key.startsWith(path + '@'))
+                continue;
+            Entry entry = entries.take(key);
+            QString retired = "retired:" + QString::number(++retiredCount);
+            entries.insert(retired, entry);
+            keys[entry.texture] = retired;
+        }
+    }
+
+    int size() const {
+        return entries.size();
+    }
+
+    Stats stats() const {
+        return counters;
+    }
+
+private:
+    TexturePool() = default;
+
+    struct Entry {
+        QOpenGLTexture* texture;
+        int refs;
+    };
+    QHash<QString, Entry> entries;
+    QHash<QOpenGLTexture*, QString> keys;
+    QVector<QImage> scratchImages = QVector<QImage>(2); // Decode targets for the two pages of a spread
+    int nextScratch = 0;
+    int retiredCount = 0;
+    QByteArray mipChain; // Levels below the one being uploaded, reused like the scratch images
+    QImage convertedImage; // 32-bit copy of the last page decoded in another format
+    MipFilter mipFilter = MIP_SMOOTH;
+    Stats counters;
+    PageCache pageCache; // The SDL viewer's page cache, same files and cap
+
+    QOpenGLTexture* share(const QString& key){
+        auto it = entries.find(key);
+        if(it == entries.end())
+            return nullptr;
+        it->refs++;
+        counters.shared++;
+        return it->texture;
+    }
+
+    QOpenGLTexture* insert(const QString& key, QOpenGLTexture* texture){
+        entries.insert(key, Entry{texture, 1});
+        keys.insert(texture, key);
+        return texture;
+    }
+
+    // A scratch image QImageReader can decode into without reallocating,
+    // or the one handed out longest ago when none matches
+    QImage& scratch(const QSize& size, QImage::Format format){
+        for(QImage& image : scratchImages){
+            if(image.size() == size && image.format() == format){
+                counters.reused++;
+                return image;
+            }
+        }
+        QImage& image = scratchImages[nextScratch];
+        nextScratch = (nextScratch + 1) % scratchImages.size();
+        return image;
+    }
+
+    // Sets `reader` to decode upright like the sizes probePage reports, and
+    // already scaled down to fit maxSize where the format can; returns the
+    // size it will decode at
+    static QSize prepareReader(QImageReader& reader, int maxSize){
+        reader.setAutoTransform(true);
+        QSize size = reader.size();
+        bool rotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+        if(maxSize > 0 && size.isValid() && !rotated && (size.width() > maxSize || size.height() > maxSize)){
+            size = size.scaled(maxSize, maxSize, Qt::KeepAspectRatio);
+            reader.setScaledSize(size);
+        }
+        return size;
+    }
+
+    // Scales down what the reader couldn't
+    static void fit(QImage& image, int maxSize){
+        if(maxSize > 0 && (image.width() > maxSize || image.height() > maxSize))
+            image = image.scaled(maxSize, maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // BGRA in memory, like the pages FreeImage decodes for the page cache
+    static bool is32Bit(const QImage& image){
+        return image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32;
+    }
+
+    // Writes a 32-bit page and its mip chain to the page cache. Any thread.
+    void store(const std::string& file, int maxSize, MipFilter filter, const QImage& image, const QByteArray& chain){
+        if(pageCache.contains(file, maxSize, filter))
+            return;
+        pageCache.store(file, maxSize, filter, image.constBits(), image.width(), image.height(),
+                        mipLevels(image.width(), image.height()), reinterpret_cast<const uchar*>(chain.constData()));
+    }
+
+    // Every level below a 32-bit image, each split into bands of rows for
+    // the global thread pool so the GUI thread mostly waits
+    void buildMipChain(const QImage& image){
+        int width = image.width(), height = image.height();
+        mipChain.resize(int(mipChainBytes(width, height)));
+        const uint8_t* src = image.constBits();
+        uint8_t* dst = reinterpret_cast<uint8_t*>(mipChain.data());
+        while(width > 1 || height > 1){
+            int w = qMax(1, width / 2), h = qMax(1, height / 2);
+            QVector<int> bands;
+            for(int y = 0; y < h; y += 64)
+                bands.append(y);
+            QtConcurrent::blockingMap(bands, [=](int y){
+                reduceLevel(src, width, height, dst, mipFilter, y, qMin(h, y + 64));
+            });
+            src = dst;
+            dst += size_t(w) * h * 4;
+            width = w;
+            height = h;
+        }
+    }
+
+    // Grayscale and palette pages, most of a manga volume, drawn into a
+    // reused 32-bit image so they get the same mip chain as colour ones.
+    // 32-bit BGRA images come back as they are.
+    const QImage& to32Bit(const QImage& image){
+        if(is32Bit(image))
+            return image;
+        counters.converted++;
+        QImage::Format target = image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+        if(convertedImage.size() != image.size() || convertedImage.format() != target || !convertedImage.isDetached())
+            convertedImage = QImage(image.size(), target);
+        QPainter painter(&convertedImage);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(0, 0, image);
+        return convertedImage;
+    }
+
+    // 32-bit images go to the GPU as they are, QOpenGLTexture(QImage)
+    // would first convert every page into a new RGBA8888 copy. Their mip
+    // chain is filtered in linear light rather than by the driver.
+    QOpenGLTexture* upload(const QImage& image){
+        const QImage& pixels = to32Bit(image);
+        buildMipChain(pixels);
+        return upload(pixels.width(), pixels.height(), pixels.constBits(),
+                      reinterpret_cast<const uchar*>(mipChain.constData()));
+    }
+
+    // BGRA level 0 and the packed levels below it, from a decoded image or
+    // a page cache mapping
+    QOpenGLTexture* upload(int width, int height, const uchar* pixels, const uchar* chain){
+        const QOpenGLTexture::PixelFormat format = QOpenGLTexture::BGRA;
+        QOpenGLTexture* texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        texture->setSize(width, height);
+        texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+        texture->setMipLevels(mipLevels(width, height));
+        texture->setAutoMipMapGenerationEnabled(false);
+        texture->allocateStorage(format, QOpenGLTexture::UInt8);
+        texture->setData(0, format, QOpenGLTexture::UInt8, pixels);
+
+        const uchar* level = chain;
+        for(int i = 1; i < texture->mipLevels(); ++i){
+            width = qMax(1, width / 2);
+            height = qMax(1, height / 2);
+            texture->setData(i, format, QOpenGLTexture::UInt8, level);
+            level += size_t(width) * height * 4;
+        }
+        texture->setMagnificationFilter(QOpenGLTexture::Linear);
+        texture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+        return texture;
+    }
+};
+
+#endif // TEXTUREPOOL_H
@@ -0,0 +1,238 @@
+#ifndef THUMBNAIL_ATLAS_H
+#define THUMBNAIL_ATLAS_H
+
+#include <GL/glew.h>
+#include <FreeImage.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "page_io.h"
+#include "page_info.h"
+
+// Thumbnails of every page of a volume for the overview grid, packed into
+// the layers of one GL_TEXTURE_2D_ARRAY so the whole grid is one instanced
+// draw. Pages are decoded on worker threads; the finished atlas is written
+// to a cache file that later opens with a single mmap and upload.
+class ThumbnailAtlas {
+public:
+    static const int cell = 128;  // Thumbnail cell, the page is letterboxed inside
+    static const int side = 2048; // Atlas layer size
+    static const int cells_per_side = side / cell;
+    static const int cells_per_layer = cells_per_side * cells_per_side;
+
+    ~ThumbnailAtlas() { close(); }
+
+    // Render thread. Uploads the cached atlas of these pages if there is
+    // one, otherwise starts building it in the background.
+    void open(const std::vector<std::string>& files, const std::vector<PageInfo>& info) {
+        close();
+        count = files.size();
+        layers = std::max(1, (count + cells_per_layer - 1) / cells_per_layer);
+        cachePath = cacheFile(files);
+
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (loadCache())
+            return;
+
+        // Cleared cells draw as placeholders until their page is decoded
+        pixels.assign(size_t(layers) * side * side * 4, 0);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, side, side, layers, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels.data());
+        ready.reset(new std::atomic<bool>[count]);
+        for (int i = 0; i < count; ++i)
+            ready[i] = false;
+        uploaded.assign(count, false);
+        buildFiles = files;
+        buildInfo = info;
+        remaining = count;
+        next = 0;
+        cancel = false;
+        finished = false;
+        mipmapped = false;
+
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned t = 0; t < threads && t < (unsigned)count; ++t)
+            workers.emplace_back([this] { build(); });
+    }
+
+    // Render thread, once per frame while the grid is shown: uploads the
+    // cells finished since the last call
+    void update() {
+        if (uploaded.empty())
+            return;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, side);
+        bool all = true;
+        for (int page = 0; page < count; ++page) {
+            if (uploaded[page])
+                continue;
+            if (!ready[page]) {
+                all = false;
+                continue;
+            }
+            int x = cellX(page) * cell, y = cellY(page) * cell;
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layerOf(page), cell, cell, 1, GL_BGRA, GL_UNSIGNED_BYTE,
+                            &pixels[((size_t(layerOf(page)) * side + y) * side + x) * 4]);
+            uploaded[page] = true;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (!all)
+            return;
+        if (!mipmapped) {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+            mipmapped = true;
+        }
+        // The pixels stay until the last worker has written them to the cache
+        if (finished) {
+            for (std::thread& t : workers)
+                t.join();
+            workers.clear();
+            uploaded.clear();
+            std::vector<unsigned char>().swap(pixels);
+        }
+    }
+
+    void close() {
+        cancel = true;
+        for (std::thread& t : workers)
+            t.join();
+        workers.clear();
+        uploaded.clear();
+        std::vector<unsigned char>().swap(pixels);
+        if (textureID)
+            glDeleteTextures(1, &textureID);
+        textureID = 0;
+        count = 0;
+    }
+
+    GLuint texture() const { return textureID; }
+    int pages() const { return count; }
+
+private:
+    struct CacheHeader {
+        char magic[8];
+        uint32_t cell, side, pages, layers;
+    };
+
+    static int layerOf(int page) { return page / cells_per_layer; }
+    static int cellX(int page) { return page % cells_per_layer % cells_per_side; }
+    static int cellY(int page) { return page % cells_per_layer / cells_per_side; }
+
+    // Named after the page files with their sizes and modification times,
+    // so editing or replacing a page rebuilds the atlas
+    static std::string cacheFile(const std::vector<std::string>& files) {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        auto mix = [&](const void* data, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ull;
+        };
+        for (const std::string& file : files) {
+            std::error_code error;
+            uint64_t size = std::filesystem::file_size(file, error);
+            int64_t time = std::filesystem::last_write_time(file, error).time_since_epoch().count();
+            mix(file.data(), file.size());
+            mix(&size, sizeof(size));
+            mix(&time, sizeof(time));
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.atlas", (unsigned long long)hash);
+        return (cacheDirectory() / name).string();
+    }
+
+    bool loadCache() {
+        PageFile file(cachePath);
+        size_t bytes = size_t(layers) * side * side * 4;
+        CacheHeader header;
+        if (!file.valid() || file.size != sizeof(header) + bytes)
+            return false;
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, "BOOKATL1", 8) != 0 || header.cell != cell || header.side != side ||
+            header.pages != (uint32_t)count || header.layers != (uint32_t)layers)
+            return false;
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, side, side, layers, 0, GL_BGRA, GL_UNSIGNED_BYTE,
+                     file.data + sizeof(header));
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        return true;
+    }
+
+    void writeCache() {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), error);
+        CacheHeader header = {{'B', 'O', 'O', 'K', 'A', 'T', 'L', '1'}, cell, side, (uint32_t)count, (uint32_t)layers};
+        // Written aside and renamed, so a reader never sees half a file
+        std::string temporary = cachePath + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+            if (!out)
+                return;
+        }
+        std::filesystem::rename(temporary, cachePath, error);
+    }
+
+    // Worker thread: decodes pages until none are left
+    void build() {
+        for (int page = next++; page < count && !cancel; page = next++) {
+            bool rotated = page < (int)buildInfo.size() && buildInfo[page].rotated();
+            FIBITMAP* src = loadBitmap(buildFiles[page], rotated ? JPEG_EXIFROTATE : 0, cell);
+            FIBITMAP* thumb = src ? FreeImage_MakeThumbnail(src, cell) : nullptr;
+            FIBITMAP* dib = thumb ? FreeImage_ConvertTo32Bits(thumb) : nullptr;
+            if (dib)
+                place(page, dib);
+            FreeImage_Unload(dib);
+            FreeImage_Unload(thumb);
+            FreeImage_Unload(src);
+            ready[page] = true;
+            if (--remaining == 0) {
+                writeCache();
+                finished = true;
+            }
+        }
+    }
+
+    // Copies a thumbnail into the middle of its cell
+    void place(int page, FIBITMAP* dib) {
+        int width = std::min<int>(FreeImage_GetWidth(dib), cell);
+        int height = std::min<int>(FreeImage_GetHeight(dib), cell);
+        int x = cellX(page) * cell + (cell - width) / 2;
+        int y = cellY(page) * cell + (cell - height) / 2;
+        unsigned char* layer = &pixels[size_t(layerOf(page)) * side * side * 4];
+        for (int row = 0; row < height; ++row)
+            std::memcpy(layer + (size_t(y + row) * side + x) * 4, FreeImage_GetScanLine(dib, row), width * 4);
+    }
+
+    GLuint textureID = 0;
+    int count = 0;
+    int layers = 0;
+    std::string cachePath;
+    std::vector<unsigned char> pixels; // Layers in upload order, only while building
+    std::vector<std::string> buildFiles;
+    std::vector<PageInfo> buildInfo;
+    std::unique_ptr<std::atomic<bool>[]> ready; // Set by the workers per page
+    std::vector<bool> uploaded;                 // Render thread only
+    std::vector<std::thread> workers;
+    std::atomic<int> next{0};
+    std::atomic<int> remaining{0};
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> finished{false}; // Every page decoded and the cache written
+    bool mipmapped = false;
+};
+
+#endif // THUMBNAIL_ATLAS_H
@@ -0,0 +1,317 @@
+#ifndef TILED_TEXTURE_H
+#define TILED_TEXTURE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <FreeImage.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Virtual texturing for pages too large to keep resident as one texture.
+// A page is split into a mip pyramid of fixed-size tiles; a page table maps
+// every (level, tile) to a slot of a shared, fixed-size tile pool. Each
+// frame only the tiles that are visible at the resolution they cover on
+// screen are requested, and anything not resident yet is drawn from the
+// nearest resident coarser tile.
+
+const int tile_size = 256;                 // Texture size of one pool slot
+const int tile_border = 1;                 // Texels duplicated from neighbours for seamless filtering
+const int tile_content = tile_size - 2 * tile_border;
+
+class TiledPage;
+
+class TilePool {
+public:
+    explicit TilePool(int slots, int uploads_per_frame)
+        : slot_count(slots), upload_budget(uploads_per_frame) {}
+
+    void beginFrame() {
+        frame++;
+        uploads_left = upload_budget;
+    }
+
+    bool canUpload() const { return uploads_left > 0; }
+
+    // Returns a free slot, evicting the least recently used unpinned tile
+    // that was not drawn this frame. -1 when the pool is exhausted.
+    int acquire(TiledPage* page, int level, int index, bool pinned);
+    void release(int slot) { slots[slot].page = nullptr; }
+    void touch(int slot) { slots[slot].last_used = frame; }
+    GLuint texture(int slot) const { return textures[slot]; }
+    void uploaded() { uploads_left--; }
+
+private:
+    struct Slot {
+        TiledPage* page = nullptr;
+        int level = 0, index = 0;
+        bool pinned = false;
+        unsigned last_used = 0;
+    };
+
+    void allocate() {
+        textures.resize(slot_count);
+        slots.resize(slot_count);
+        glGenTextures(slot_count, textures.data());
+        for (GLuint tex : textures) {
+            glBindTexture(GL_TEXTURE_2D, tex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tile_size, tile_size, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    }
+
+    int slot_count;
+    int upload_budget;
+    int uploads_left = 0;
+    unsigned frame = 1;
+    std::vector<GLuint> textures;
+    std::vector<Slot> slots;
+};
+
+// One quad to draw: `rect` is the part of the page it covers in page
+// coordinates (0..1), `tex_offset`/`tex_scale` select the texels of the tile.
+struct TileDraw {
+    GLuint texture;
+    float rect[4];
+    float tex_offset[2];
+    float tex_scale[2];
+};
+
+class TiledPage {
+public:
+    // Takes ownership of a 32-bit bitmap and builds the rest of the pyramid
+    TiledPage(FIBITMAP* dib, TilePool& tile_pool) : pool(tile_pool), base(dib) {
+        Level level0;
+        level0.width = FreeImage_GetWidth(dib);
+        level0.height = FreeImage_GetHeight(dib);
+        levels.push_back(level0);
+        while (levels.back().width > tile_content || levels.back().height > tile_content)
+            levels.push_back(downsample(levels.back(), levelData(levels.size() - 1)));
+
+        for (Level& level : levels) {
+            level.tiles_x = (level.width + tile_content - 1) / tile_content;
+            level.tiles_y = (level.height + tile_content - 1) / tile_content;
+            level.slots.assign(level.tiles_x * level.tiles_y, -1);
+        }
+    }
+
+    ~TiledPage() {
+        for (Level& level : levels)
+            for (int slot : level.slots)
+                if (slot >= 0)
+                    pool.release(slot);
+        FreeImage_Unload(base);
+    }
+
+    TiledPage(const TiledPage&) = delete;
+    TiledPage& operator=(const TiledPage&) = delete;
+
+    int width() const { return levels[0].width; }
+    int height() const { return levels[0].height; }
+
+    // Collects the tiles to draw for a page spanning [x0,x1]x[y0,y1] at depth
+    // z in model space, refining from the single coarsest tile down to the
+    // level whose texels are no larger than a screen pixel.
+    void collect(const glm::mat4& mvp, int viewport_w, int viewport_h,
+                 float x0, float x1, float y0, float y1, float z, std::vector<TileDraw>& out) {
+        this->mvp = mvp;
+        vw = viewport_w;
+        vh = viewport_h;
+        px0 = x0; px1 = x1; py0 = y0; py1 = y1; pz = z;
+        // The coarsest tile is always resident so there is something to fall back to
+        if (levels.back().slots[0] < 0)
+            request(levels.size() - 1, 0, true);
+        refine(levels.size() - 1, 0, 0, out);
+    }
+
+    // Called by the pool when a slot is taken away
+    void evicted(int level, int index) { levels[level].slots[index] = -1; }
+
+private:
+    struct Level {
+        int width = 0, height = 0;
+        int tiles_x = 0, tiles_y = 0;
+        std::vector<uint8_t> pixels; // Empty for level 0, which lives in `base`
+        std::vector<int> slots;      // Page table: pool slot of every tile or -1
+    };
+
+    const uint8_t* levelData(size_t level) const {
+        return level == 0 ? FreeImage_GetBits(base) : levels[level].pixels.data();
+    }
+
+    static Level downsample(const Level& src, const uint8_t* data) {
+        Level dst;
+        dst.width = std::max(1, (src.width + 1) / 2);
+        dst.height = std::max(1, (src.height + 1) / 2);
+        dst.pixels.resize(size_t(dst.width) * dst.height * 4);
+        for (int y = 0; y < dst.height; ++y) {
+            const uint8_t* row0 = data + size_t(2 * y) * src.width * 4;
+            const uint8_t* row1 = data + size_t(std::min(2 * y + 1, src.height - 1)) * src.width * 4;
+            uint8_t* out = dst.pixels.data() + size_t(y) * dst.width * 4;
+            for (int x = 0; x < dst.width; ++x) {
+                int xa = 2 * x * 4, xb = std::min(2 * x + 1, src.width - 1) * 4;
+                for (int c = 0; c < 4; ++c)
+                    out[x * 4 + c] = (row0[xa + c] + row0[xb + c] + row1[xa + c] + row1[xb + c] + 2) / 4;
+            }
+        }
+        return dst;
+    }
+
+    // Content rectangle of a tile in texels of its level
+    void tileRect(int level, int tx, int ty, int& cx0, int& cy0, int& cx1, int& cy1) const {
+        const Level& l = levels[level];
+        cx0 = tx * tile_content;
+        cy0 = ty * tile_content;
+        cx1 = std::min(cx0 + tile_content, l.width);
+        cy1 = std::min(cy0 + tile_content, l.height);
+    }
+
+    bool request(int level, int index, bool pinned) {
+        if (!pool.canUpload())
+            return false;
+        int slot = pool.acquire(this, level, index, pinned);
+        if (slot < 0)
+            return false;
+
+        const Level& l = levels[level];
+        int cx0, cy0, cx1, cy1;
+        tileRect(level, index % l.tiles_x, index / l.tiles_x, cx0, cy0, cx1, cy1);
+        int sx0 = std::max(cx0 - tile_border, 0), sy0 = std::max(cy0 - tile_border, 0);
+        int sx1 = std::min(cx1 + tile_border, l.width), sy1 = std::min(cy1 + tile_border, l.height);
+
+        glBindTexture(GL_TEXTURE_2D, pool.texture(slot));
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, l.width);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, cx0 - sx0 == 0 ? tile_border : 0, cy0 - sy0 == 0 ? tile_border : 0,
+                        sx1 - sx0, sy1 - sy0, GL_BGRA, GL_UNSIGNED_BYTE,
+                        levelData(level) + (size_t(sy0) * l.width + sx0) * 4);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        pool.uploaded();
+
+        levels[level].slots[index] = slot;
+        return true;
+    }
+
+    // Screen footprint of a part of the page given in page coordinates.
+    // Returns false when it is entirely outside the view frustum.
+    bool project(float u0, float v0, float u1, float v1, float& pixels) const {
+        glm::vec4 corners[4] = {
+            mvp * glm::vec4(px0 + (px1 - px0) * u0, py0 + (py1 - py0) * v0, pz, 1.0f),
+            mvp * glm::vec4(px0 + (px1 - px0) * u1, py0 + (py1 - py0) * v0, pz, 1.0f),
+            mvp * glm::vec4(px0 + (px1 - px0) * u1, py0 + (py1 - py0) * v1, pz, 1.0f),
+            mvp * glm::vec4(px0 + (px1 - px0) * u0, py0 + (py1 - py0) * v1, pz, 1.0f),
+        };
+        for (int axis = 0; axis < 3; ++axis) {
+            bool below = true, above = true;
+            for (const glm::vec4& c : corners) {
+                below = below && c[axis] < -c.w;
+                above = above && c[axis] > c.w;
+            }
+            if (below || above)
+                return false;
+        }
+        pixels = 0.0f;
+        for (int i = 0; i < 4; ++i) {
+            const glm::vec4& a = corners[i];
+            const glm::vec4& b = corners[(i + 1) % 4];
+            if (a.w <= 1e-4f || b.w <= 1e-4f)
+                return true; // Crosses the eye plane, keep the current level
+            float dx = (a.x / a.w - b.x / b.w) * 0.5f * vw;
+            float dy = (a.y / a.w - b.y / b.w) * 0.5f * vh;
+            pixels = std::max(pixels, std::sqrt(dx * dx + dy * dy));
+        }
+        return true;
+    }
+
+    void refine(int level, int tx, int ty, std::vector<TileDraw>& out) {
+        const Level& l = levels[level];
+        int cx0, cy0, cx1, cy1;
+        tileRect(level, tx, ty, cx0, cy0, cx1, cy1);
+        float u0 = float(cx0) / l.width, u1 = float(cx1) / l.width;
+        float v0 = float(cy0) / l.height, v1 = float(cy1) / l.height;
+
+        float pixels;
+        if (!project(u0, v0, u1, v1, pixels))
+            return;
+
+        if (level > 0 && pixels > std::max(cx1 - cx0, cy1 - cy0)) {
+            const Level& finer = levels[level - 1];
+            for (int cy = 2 * ty; cy <= 2 * ty + 1 && cy < finer.tiles_y; ++cy)
+                for (int cx = 2 * tx; cx <= 2 * tx + 1 && cx < finer.tiles_x; ++cx)
+                    refine(level - 1, cx, cy, out);
+            return;
+        }
+
+        // Find the finest resident tile covering this one, starting with itself
+        int index = ty * l.tiles_x + tx;
+        if (l.slots[index] < 0)
+            request(level, index, false);
+        for (int a = level; a < (int)levels.size(); ++a) {
+            const Level& al = levels[a];
+            int scale = 1 << (a - level);
+            int atx = tx / scale, aty = ty / scale;
+            int slot = al.slots[aty * al.tiles_x + atx];
+            if (slot < 0)
+                continue;
+
+            int ax0, ay0, ax1, ay1;
+            tileRect(a, atx, aty, ax0, ay0, ax1, ay1);
+            int sx0 = std::max(ax0 - tile_border, 0), sy0 = std::max(ay0 - tile_border, 0);
+            int ox = ax0 - sx0 == 0 ? tile_border : 0, oy = ay0 - sy0 == 0 ? tile_border : 0;
+
+            TileDraw draw;
+            draw.texture = pool.texture(slot);
+            draw.rect[0] = u0; draw.rect[1] = v0; draw.rect[2] = u1; draw.rect[3] = v1;
+            draw.tex_offset[0] = (float(cx0) / scale - sx0 + ox) / tile_size;
+            draw.tex_offset[1] = (float(cy0) / scale - sy0 + oy) / tile_size;
+            draw.tex_scale[0] = float(cx1 - cx0) / scale / tile_size;
+            draw.tex_scale[1] = float(cy1 - cy0) / scale / tile_size;
+            out.push_back(draw);
+            pool.touch(slot);
+            return;
+        }
+    }
+
+    TilePool& pool;
+    FIBITMAP* base;
+    std::vector<Level> levels;
+
+    glm::mat4 mvp;
+    int vw = 0, vh = 0;
+    float px0 = 0, px1 = 0, py0 = 0, py1 = 0, pz = 0;
+};
+
+inline int TilePool::acquire(TiledPage* page, int level, int index, bool pinned) {
+    if (textures.empty())
+        allocate();
+
+    int best = -1;
+    for (int i = 0; i < slot_count; ++i) {
+        const Slot& s = slots[i];
+        if (!s.page) {
+            best = i;
+            break;
+        }
+        if (s.pinned || s.last_used == frame)
+            continue;
+        if (best < 0 || s.last_used < slots[best].last_used)
+            best = i;
+    }
+    if (best < 0)
+        return -1;
+
+    Slot& s = slots[best];
+    if (s.page)
+        s.page->evicted(s.level, s.index);
+    s.page = page;
+    s.level = level;
+    s.index = index;
+    s.pinned = pinned;
+    s.last_used = frame;
+    return best;
+}
+
+#endif // TILED_TEXTURE_H